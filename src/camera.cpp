@@ -0,0 +1,75 @@
+#include "camera.h"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr glm::vec3 WORLD_UP(0.0f, 1.0f, 0.0f);
+static constexpr float MAX_PITCH = 1.55f;
+static constexpr float MIN_DISTANCE = 1.0f;
+
+void camera::look_at(Camera &S_camera, const glm::vec3 &vec_origin,
+		     const glm::vec3 &vec_target, float f_fov)
+{
+	S_camera.vec_scene_center = vec_target;
+	S_camera.vec_camera_origin = vec_origin;
+	S_camera.vec_view_dir = glm::normalize(S_camera.vec_scene_center -
+					       S_camera.vec_camera_origin);
+	S_camera.vec_right =
+		glm::normalize(glm::cross(S_camera.vec_view_dir, WORLD_UP));
+	S_camera.vec_up =
+		glm::cross(S_camera.vec_right, S_camera.vec_view_dir);
+
+	S_camera.f_fov = f_fov;
+	S_camera.f_focal_length = glm::length(S_camera.vec_scene_center -
+					      S_camera.vec_camera_origin);
+	S_camera.f_viewport_height = 2.0f * S_camera.f_focal_length *
+				     tan(glm::radians(S_camera.f_fov) / 2.0f);
+	S_camera.f_viewport_width = S_camera.f_viewport_height;
+
+	S_camera.vec_lower_left_corner =
+		S_camera.vec_camera_origin +
+		S_camera.vec_view_dir * S_camera.f_focal_length -
+		S_camera.vec_right * (S_camera.f_viewport_width * 0.5f) -
+		S_camera.vec_up * (S_camera.f_viewport_height * 0.5f);
+}
+
+void camera::orbit(Camera &S_camera, float f_yaw, float f_pitch)
+{
+	const glm::vec3 vec_offset =
+		S_camera.vec_camera_origin - S_camera.vec_scene_center;
+	const float f_distance = glm::length(vec_offset);
+
+	float f_cur_yaw = atan2(vec_offset.x, vec_offset.z) + f_yaw;
+	float f_cur_pitch = asin(glm::clamp(vec_offset.y / f_distance, -1.0f,
+					    1.0f)) +
+			    f_pitch;
+	f_cur_pitch = glm::clamp(f_cur_pitch, -MAX_PITCH, MAX_PITCH);
+
+	const glm::vec3 vec_new_offset =
+		f_distance * glm::vec3(cos(f_cur_pitch) * sin(f_cur_yaw),
+				       sin(f_cur_pitch),
+				       cos(f_cur_pitch) * cos(f_cur_yaw));
+	look_at(S_camera, S_camera.vec_scene_center + vec_new_offset,
+		S_camera.vec_scene_center, S_camera.f_fov);
+}
+
+void camera::pan(Camera &S_camera, float f_offset_x, float f_offset_y)
+{
+	const glm::vec3 vec_shift =
+		S_camera.vec_right * (f_offset_x * S_camera.f_viewport_width) +
+		S_camera.vec_up * (f_offset_y * S_camera.f_viewport_height);
+	look_at(S_camera, S_camera.vec_camera_origin + vec_shift,
+		S_camera.vec_scene_center + vec_shift, S_camera.f_fov);
+}
+
+void camera::zoom(Camera &S_camera, float f_factor)
+{
+	const glm::vec3 vec_offset =
+		S_camera.vec_camera_origin - S_camera.vec_scene_center;
+	const float f_distance =
+		std::max(glm::length(vec_offset) * f_factor, MIN_DISTANCE);
+	look_at(S_camera,
+		S_camera.vec_scene_center +
+			glm::normalize(vec_offset) * f_distance,
+		S_camera.vec_scene_center, S_camera.f_fov);
+}
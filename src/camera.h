@@ -0,0 +1,21 @@
+#pragma once
+
+#include "common.h"
+
+#include <glm/glm.hpp>
+
+namespace camera
+{
+void look_at(Camera &S_camera, const glm::vec3 &vec_origin,
+	     const glm::vec3 &vec_target, float f_fov);
+
+// Rotates the camera around its target; angles are in radians.
+void orbit(Camera &S_camera, float f_yaw, float f_pitch);
+
+// Moves camera and target together; offsets are fractions of the viewport.
+void pan(Camera &S_camera, float f_offset_x, float f_offset_y);
+
+// Scales the distance to the target, values below one move closer.
+void zoom(Camera &S_camera, float f_factor);
+
+} // namespace camera
@@ -0,0 +1,341 @@
+#include "checkpoint.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static constexpr char CHECKPOINT_MAGIC[8] = { 'D', 'N', 'Z', 'C',
+					      'K', 'P', 'T', '\0' };
+// Version 4 stores linear rather than tonemapped color.
+static constexpr uint32_t CHECKPOINT_VERSION = 4;
+static constexpr size_t CHECKPOINT_PAGE = 4096;
+static constexpr uint32_t CHECKPOINT_CHANNELS = 3;
+
+enum CheckpointChannel : uint32_t {
+	CHANNEL_COLOR,
+	CHANNEL_ALBEDO,
+	CHANNEL_NORMAL
+};
+
+struct CheckpointHeader {
+	char magic[8];
+	uint32_t u_version;
+	int32_t i_width;
+	int32_t i_height;
+	uint32_t u_active_slot;
+	uint64_t u_seed;
+	int32_t a_sample_count[2];
+	uint32_t a_aux_valid[2];
+	Camera S_camera;
+};
+
+static_assert(sizeof(CheckpointHeader) <= CHECKPOINT_PAGE);
+
+static size_t round_up_to_page(size_t u_bytes)
+{
+	return (u_bytes + CHECKPOINT_PAGE - 1) / CHECKPOINT_PAGE *
+	       CHECKPOINT_PAGE;
+}
+
+Renderer::Checkpoint::Checkpoint(const std::string &s_path,
+				 const int32_t i_width, const int32_t i_height)
+	: s_path(s_path)
+	, i_width(i_width)
+	, i_height(i_height)
+{
+	u_mapping_size = CHECKPOINT_PAGE + 2 * slot_bytes();
+}
+
+Renderer::Checkpoint::~Checkpoint()
+{
+	unmap_file();
+}
+
+size_t Renderer::Checkpoint::channel_bytes(uint32_t u_channel) const
+{
+	// Color is accumulated in float, the feature buffers are half.
+	const size_t u_element_bytes =
+		u_channel == CHANNEL_COLOR ? sizeof(float) : sizeof(uint16_t);
+	return static_cast<size_t>(i_width) * i_height * 3 * u_element_bytes;
+}
+
+size_t Renderer::Checkpoint::slot_bytes() const
+{
+	size_t u_bytes = 0;
+	for (uint32_t c = 0; c < CHECKPOINT_CHANNELS; c++) {
+		u_bytes += round_up_to_page(channel_bytes(c));
+	}
+	return u_bytes;
+}
+
+uint8_t *Renderer::Checkpoint::slot_buffer(uint32_t u_slot,
+					   uint32_t u_channel) const
+{
+	size_t u_offset = CHECKPOINT_PAGE + u_slot * slot_bytes();
+	for (uint32_t c = 0; c < u_channel; c++) {
+		u_offset += round_up_to_page(channel_bytes(c));
+	}
+	return p_mapping + u_offset;
+}
+
+#ifdef _WIN32
+bool Renderer::Checkpoint::map_file(bool b_create)
+{
+	p_file = CreateFileA(s_path.c_str(), GENERIC_READ | GENERIC_WRITE, 0,
+			     nullptr, b_create ? CREATE_ALWAYS : OPEN_EXISTING,
+			     FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (p_file == INVALID_HANDLE_VALUE) {
+		p_file = nullptr;
+		return false;
+	}
+
+	LARGE_INTEGER t_size;
+	if (!b_create && (!GetFileSizeEx(p_file, &t_size) ||
+			  static_cast<size_t>(t_size.QuadPart) !=
+				  u_mapping_size)) {
+		unmap_file();
+		return false;
+	}
+
+	p_file_mapping = CreateFileMappingA(
+		p_file, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(static_cast<uint64_t>(u_mapping_size) >> 32),
+		static_cast<DWORD>(u_mapping_size & 0xffffffffu), nullptr);
+	if (!p_file_mapping) {
+		unmap_file();
+		return false;
+	}
+
+	p_mapping = static_cast<uint8_t *>(MapViewOfFile(
+		p_file_mapping, FILE_MAP_ALL_ACCESS, 0, 0, u_mapping_size));
+	if (!p_mapping) {
+		unmap_file();
+		return false;
+	}
+	return true;
+}
+
+void Renderer::Checkpoint::unmap_file()
+{
+	if (p_mapping) {
+		FlushViewOfFile(p_mapping, u_mapping_size);
+		UnmapViewOfFile(p_mapping);
+		p_mapping = nullptr;
+	}
+	if (p_file_mapping) {
+		CloseHandle(p_file_mapping);
+		p_file_mapping = nullptr;
+	}
+	if (p_file) {
+		CloseHandle(p_file);
+		p_file = nullptr;
+	}
+}
+
+void Renderer::Checkpoint::flush(const void *p_begin, size_t u_bytes)
+{
+	FlushViewOfFile(p_begin, u_bytes);
+	FlushFileBuffers(p_file);
+}
+#else
+bool Renderer::Checkpoint::map_file(bool b_create)
+{
+	const int32_t i_flags = b_create ? (O_RDWR | O_CREAT | O_TRUNC) :
+					   O_RDWR;
+	i_fd = ::open(s_path.c_str(), i_flags, 0644);
+	if (i_fd < 0) {
+		return false;
+	}
+
+	if (b_create) {
+		if (ftruncate(i_fd, static_cast<off_t>(u_mapping_size)) != 0) {
+			unmap_file();
+			return false;
+		}
+	} else if (lseek(i_fd, 0, SEEK_END) !=
+		   static_cast<off_t>(u_mapping_size)) {
+		unmap_file();
+		return false;
+	}
+
+	void *p_mapped = mmap(nullptr, u_mapping_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED, i_fd, 0);
+	if (p_mapped == MAP_FAILED) {
+		unmap_file();
+		return false;
+	}
+	p_mapping = static_cast<uint8_t *>(p_mapped);
+	return true;
+}
+
+void Renderer::Checkpoint::unmap_file()
+{
+	if (p_mapping) {
+		munmap(p_mapping, u_mapping_size);
+		p_mapping = nullptr;
+	}
+	if (i_fd >= 0) {
+		close(i_fd);
+		i_fd = -1;
+	}
+}
+
+void Renderer::Checkpoint::flush(const void *p_begin, size_t u_bytes)
+{
+	// msync wants a page aligned start address.
+	const uintptr_t u_begin = reinterpret_cast<uintptr_t>(p_begin);
+	const uintptr_t u_aligned = u_begin & ~(CHECKPOINT_PAGE - 1);
+	msync(reinterpret_cast<void *>(u_aligned),
+	      u_bytes + (u_begin - u_aligned), MS_SYNC);
+}
+#endif
+
+bool Renderer::Checkpoint::file_exists() const
+{
+	std::error_code t_error;
+	return std::filesystem::exists(s_path, t_error);
+}
+
+bool Renderer::Checkpoint::open_existing()
+{
+	unmap_file();
+	if (!map_file(false)) {
+		std::cerr << "Checkpoint " << s_path
+			  << " cannot be opened or is not the size of a "
+			  << i_width << "x" << i_height << " checkpoint\n";
+		return false;
+	}
+
+	const CheckpointHeader *p_header =
+		reinterpret_cast<const CheckpointHeader *>(p_mapping);
+	if (std::memcmp(p_header->magic, CHECKPOINT_MAGIC,
+			sizeof(CHECKPOINT_MAGIC)) != 0) {
+		std::cerr << "Checkpoint " << s_path
+			  << " has no valid header\n";
+	} else if (p_header->u_version != CHECKPOINT_VERSION) {
+		std::cerr << "Checkpoint " << s_path << " is version "
+			  << p_header->u_version << ", this build reads "
+			  << CHECKPOINT_VERSION << "\n";
+	} else if (p_header->i_width != i_width ||
+		   p_header->i_height != i_height) {
+		std::cerr << "Checkpoint " << s_path << " is "
+			  << p_header->i_width << "x" << p_header->i_height
+			  << ", this render is " << i_width << "x" << i_height
+			  << "\n";
+	} else {
+		return true;
+	}
+	unmap_file();
+	return false;
+}
+
+bool Renderer::Checkpoint::create()
+{
+	unmap_file();
+	if (!map_file(true)) {
+		std::cerr << "Failed to create checkpoint " << s_path << "\n";
+		return false;
+	}
+
+	CheckpointHeader *p_header =
+		reinterpret_cast<CheckpointHeader *>(p_mapping);
+	*p_header = CheckpointHeader{};
+	std::memcpy(p_header->magic, CHECKPOINT_MAGIC,
+		    sizeof(CHECKPOINT_MAGIC));
+	p_header->u_version = CHECKPOINT_VERSION;
+	p_header->i_width = i_width;
+	p_header->i_height = i_height;
+	flush(p_header, sizeof(CheckpointHeader));
+	return true;
+}
+
+void Renderer::Checkpoint::reset()
+{
+	if (!p_mapping) {
+		return;
+	}
+
+	// Neither slot matches the new view any more. Nothing is synced here;
+	// the next save() flushes the header along with its slot, and until
+	// then a crash leaves a file that restore() refuses.
+	CheckpointHeader *p_header =
+		reinterpret_cast<CheckpointHeader *>(p_mapping);
+	p_header->a_aux_valid[0] = 0;
+	p_header->a_aux_valid[1] = 0;
+}
+
+void Renderer::Checkpoint::save(const CheckpointState &S_state,
+				const Film &S_film)
+{
+	if (!p_mapping) {
+		return;
+	}
+
+	CheckpointHeader *p_header =
+		reinterpret_cast<CheckpointHeader *>(p_mapping);
+	const uint32_t u_slot = p_header->u_active_slot ^ 1u;
+
+	std::memcpy(slot_buffer(u_slot, CHANNEL_COLOR), S_film.v_color.data(),
+		    channel_bytes(CHANNEL_COLOR));
+	size_t u_dirty_bytes = round_up_to_page(channel_bytes(CHANNEL_COLOR));
+	if (!p_header->a_aux_valid[u_slot]) {
+		std::memcpy(slot_buffer(u_slot, CHANNEL_ALBEDO),
+			    S_film.v_albedo.data(),
+			    channel_bytes(CHANNEL_ALBEDO));
+		std::memcpy(slot_buffer(u_slot, CHANNEL_NORMAL),
+			    S_film.v_normal.data(),
+			    channel_bytes(CHANNEL_NORMAL));
+		u_dirty_bytes = slot_bytes();
+	}
+
+	// The slot has to be durable before the header points at it.
+	flush(slot_buffer(u_slot, CHANNEL_COLOR), u_dirty_bytes);
+
+	p_header->u_seed = S_state.u_seed;
+	p_header->S_camera = S_state.S_camera;
+	p_header->a_sample_count[u_slot] = S_state.i_sample_count;
+	p_header->a_aux_valid[u_slot] = 1;
+	std::atomic_thread_fence(std::memory_order_release);
+	p_header->u_active_slot = u_slot;
+	flush(p_header, sizeof(CheckpointHeader));
+}
+
+bool Renderer::Checkpoint::restore(CheckpointState &S_state,
+				   Film &S_film) const
+{
+	if (!p_mapping) {
+		return false;
+	}
+
+	const CheckpointHeader *p_header =
+		reinterpret_cast<const CheckpointHeader *>(p_mapping);
+	const uint32_t u_slot = p_header->u_active_slot;
+	if (!p_header->a_aux_valid[u_slot]) {
+		return false;
+	}
+
+	std::memcpy(S_film.v_color.data(), slot_buffer(u_slot, CHANNEL_COLOR),
+		    channel_bytes(CHANNEL_COLOR));
+	std::memcpy(S_film.v_albedo.data(),
+		    slot_buffer(u_slot, CHANNEL_ALBEDO),
+		    channel_bytes(CHANNEL_ALBEDO));
+	std::memcpy(S_film.v_normal.data(),
+		    slot_buffer(u_slot, CHANNEL_NORMAL),
+		    channel_bytes(CHANNEL_NORMAL));
+
+	S_state.i_width = p_header->i_width;
+	S_state.i_height = p_header->i_height;
+	S_state.u_seed = p_header->u_seed;
+	S_state.i_sample_count = p_header->a_sample_count[u_slot];
+	S_state.S_camera = p_header->S_camera;
+	return true;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "common.h"
+#include "film.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Renderer
+{
+struct CheckpointState {
+	int32_t i_width;
+	int32_t i_height;
+	uint64_t u_seed;
+	int32_t i_sample_count;
+	Camera S_camera;
+};
+
+/*
+Memory-mapped snapshot of the accumulation buffers. The file holds two slots;
+a save fills the inactive slot, syncs it and only then flips the header, so a
+process killed mid-save still leaves the previous checkpoint intact. Albedo and
+normal do not change between samples, so after the first save into a slot only
+the color pages are rewritten and synced.
+*/
+class Checkpoint {
+	std::string s_path;
+	int32_t i_width = 0;
+	int32_t i_height = 0;
+
+	uint8_t *p_mapping = nullptr;
+	size_t u_mapping_size = 0;
+#ifdef _WIN32
+	void *p_file = nullptr;
+	void *p_file_mapping = nullptr;
+#else
+	int32_t i_fd = -1;
+#endif
+
+    private:
+	size_t channel_bytes(uint32_t u_channel) const;
+	size_t slot_bytes() const;
+	uint8_t *slot_buffer(uint32_t u_slot, uint32_t u_channel) const;
+	bool map_file(bool b_create);
+	void unmap_file();
+	void flush(const void *p_begin, size_t u_bytes);
+
+    public:
+	Checkpoint(const std::string &s_path, const int32_t i_width,
+		   const int32_t i_height);
+	~Checkpoint();
+
+	Checkpoint(const Checkpoint &) = delete;
+	Checkpoint &operator=(const Checkpoint &) = delete;
+
+	bool file_exists() const;
+	// Maps an existing checkpoint file. Returns false, saying why, if it
+	// is missing, truncated or was written by another version or for a
+	// different resolution.
+	bool open_existing();
+	// Creates (or truncates) the file and maps it.
+	bool create();
+	// Invalidates both slots in place, for a render that restarted with a
+	// new view. Cheap enough to call on every camera change.
+	void reset();
+
+	void save(const CheckpointState &S_state, const Film &S_film);
+	bool restore(CheckpointState &S_state, Film &S_film) const;
+};
+} // namespace Renderer
@@ -6,6 +6,12 @@
 
 #include <cstdint>
 
+namespace Renderer
+{
+class RadianceCache;
+class TextureCache;
+}
+
 struct Vertex {
 	float x, y, z;
 };
@@ -14,6 +20,13 @@ struct Triangle {
 	uint32_t v0, v1, v2;
 };
 
+// Texture ids in the scene's TextureCache, -1 where the material has none.
+struct MaterialTextures {
+	int32_t i_diffuse = -1;
+	int32_t i_specular = -1;
+	int32_t i_emission = -1;
+};
+
 struct GeometryUserData {
 	const tinyobj::mesh_t *mesh_ptr;
 };
@@ -24,6 +37,12 @@ struct Scene {
 	std::vector<tinyobj::shape_t> v_shapes;
 	std::vector<tinyobj::material_t> v_materials;
 	float f_ambient_intensity;
+	// Optional, owned by the engine.
+	Renderer::RadianceCache *p_radiance_cache = nullptr;
+	// Null for untextured scenes, which leave v_material_textures empty.
+	// Otherwise it is indexed like v_materials.
+	Renderer::TextureCache *p_texture_cache = nullptr;
+	std::vector<MaterialTextures> v_material_textures;
 };
 
 struct Camera {
@@ -40,6 +59,13 @@ struct Camera {
 	float f_viewport_width;
 };
 
+struct Material {
+	glm::vec3 diffuse;
+	glm::vec3 specular;
+	glm::vec3 emission;
+	float f_shininess;
+};
+
 struct SurfaceInfo {
 	glm::vec3 color;
 	glm::vec3 albedo;
@@ -0,0 +1,496 @@
+#include "common.h"
+#include "lighting.h"
+#include "renderer.h"
+#include "tonemap.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+Equal-time convergence harness. Renders the scene to a high sample count once
+and caches it as a PFM reference, then renders it again under the configuration
+being evaluated. At each wall-clock checkpoint it measures how far the raw
+accumulation and both denoiser outputs are from the reference. Only time spent
+tracing counts towards the checkpoints; film allocation, logging and evaluation
+pause the clock. Samples are whole passes, so each row is measured at the first
+pass boundary at or past its checkpoint, and render_s records the trace time
+actually spent by then.
+
+The film and the reference hold linear radiance, so RMSE and relMSE measure the
+estimator itself. SSIM assumes a [0, 1] signal and is taken on the tonemapped
+luminance of both images instead.
+*/
+
+static constexpr float SCENE_AMBIENT = 0.075f;
+static constexpr float REL_MSE_EPSILON = 1e-2f;
+// Integrator comparison: a pixel counts as different beyond this relative
+// error, and a rare few may, where float rounding tips a path the other way.
+static constexpr uint64_t COMPARE_SEED = 1;
+static constexpr double COMPARE_PIXEL_TOLERANCE = 1e-3;
+static constexpr double COMPARE_MAX_DIFFERING = 1e-3;
+static constexpr int32_t SSIM_WINDOW = 8;
+static constexpr int32_t SSIM_STRIDE = 4;
+static constexpr double SSIM_C1 = 0.01 * 0.01;
+static constexpr double SSIM_C2 = 0.03 * 0.03;
+
+struct ErrorMetrics {
+	double f_rmse;
+	double f_rel_mse;
+	double f_ssim;
+};
+
+struct CurvePoint {
+	double f_checkpoint;
+	double f_render_time;
+	int32_t i_samples;
+	ErrorMetrics S_raw;
+	ErrorMetrics S_oidn;
+	ErrorMetrics S_custom;
+	double f_oidn_time;
+};
+
+static double now_seconds()
+{
+	return std::chrono::duration<double>(
+		       std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+static void print_usage(const char *psz_program)
+{
+	std::cerr << "Usage: " << psz_program
+		  << " [--scene FILE] [--base-dir DIR]"
+		     " [--size N] [--reference-spp N] [--rebuild-reference]"
+		     " [--times S,S,...] [--label NAME] [--output PREFIX]"
+		     " [--wavefront] [--radiance-cache CELL_SIZE]"
+		     " [--compare-integrators SPP]\n";
+}
+
+// PFM rows run bottom to top, which is the film's own order.
+static bool read_pfm(const std::string &s_path, const int32_t i_width,
+		     const int32_t i_height, std::vector<float> &v_pixels)
+{
+	std::ifstream t_file(s_path, std::ios::binary);
+	std::string s_magic;
+	int32_t i_file_width = 0;
+	int32_t i_file_height = 0;
+	float f_scale = 0.0f;
+	if (!(t_file >> s_magic >> i_file_width >> i_file_height >> f_scale) ||
+	    s_magic != "PF" || i_file_width != i_width ||
+	    i_file_height != i_height || f_scale >= 0.0f) {
+		return false;
+	}
+	t_file.get();
+
+	v_pixels.resize(static_cast<size_t>(i_width) * i_height * 3);
+	t_file.read(reinterpret_cast<char *>(v_pixels.data()),
+		    static_cast<std::streamsize>(v_pixels.size() *
+						 sizeof(float)));
+	return static_cast<bool>(t_file);
+}
+
+static void write_pfm(const std::string &s_path, const int32_t i_width,
+		      const int32_t i_height, const float *p_pixels)
+{
+	std::ofstream t_file(s_path, std::ios::binary);
+	t_file << "PF\n" << i_width << " " << i_height << "\n-1.0\n";
+	t_file.write(reinterpret_cast<const char *>(p_pixels),
+		     static_cast<std::streamsize>(i_width) * i_height * 3 *
+			     sizeof(float));
+}
+
+// 64-bit FNV-1a, stable across runs and builds unlike std::hash.
+static uint64_t fnv1a(const std::string &s_data)
+{
+	uint64_t u_hash = 0xcbf29ce484222325ull;
+	for (const char c : s_data) {
+		u_hash ^= static_cast<uint8_t>(c);
+		u_hash *= 0x100000001b3ull;
+	}
+	return u_hash;
+}
+
+// Cache file of the reference for everything it depends on: the integrator
+// settings, the ambient term and the scene file's path and contents, next to
+// the resolution and sample count. Changing any of them picks a new file; the
+// light itself is fixed in lighting.cpp and still needs --rebuild-reference.
+static std::string reference_file(const std::string &s_scene_file,
+				  const int32_t i_size, const int32_t i_spp)
+{
+	std::ifstream t_scene(s_scene_file, std::ios::binary);
+	const std::string s_scene{ std::istreambuf_iterator<char>(t_scene),
+				   std::istreambuf_iterator<char>() };
+
+	std::ostringstream t_key;
+	t_key << "recursive hdr depth=" << lighting::LIGHT_BOUNCE_DEPTH
+	      << " shadow=" << lighting::SHADOW_SAMPLES
+	      << " ambient=" << SCENE_AMBIENT << " scene=" << s_scene_file
+	      << " " << fnv1a(s_scene);
+
+	std::ostringstream t_name;
+	t_name << "convergence_reference_" << i_size << "_" << i_spp << "_"
+	       << std::hex << std::setw(16) << std::setfill('0')
+	       << fnv1a(t_key.str()) << ".pfm";
+	return t_name.str();
+}
+
+static std::vector<float> display_luminance(const float *p_pixels,
+					    const size_t u_pixel_count)
+{
+	std::vector<float> v_luminance(u_pixel_count);
+	for (size_t i = 0; i < u_pixel_count; i++) {
+		v_luminance[i] = ACES_tonemapper(0.2126f * p_pixels[i * 3 + 0] +
+						 0.7152f * p_pixels[i * 3 + 1] +
+						 0.0722f * p_pixels[i * 3 + 2]);
+	}
+	return v_luminance;
+}
+
+// Mean SSIM of the display luminance over overlapping square windows.
+static double compute_ssim(const float *p_image, const float *p_reference,
+			   const int32_t i_width, const int32_t i_height)
+{
+	const size_t u_pixel_count = static_cast<size_t>(i_width) * i_height;
+	const std::vector<float> v_x =
+		display_luminance(p_image, u_pixel_count);
+	const std::vector<float> v_y =
+		display_luminance(p_reference, u_pixel_count);
+
+	double f_sum = 0.0;
+	int64_t i_windows = 0;
+#pragma omp parallel for reduction(+ : f_sum, i_windows) schedule(static)
+	for (int32_t i_y0 = 0; i_y0 <= i_height - SSIM_WINDOW;
+	     i_y0 += SSIM_STRIDE) {
+		for (int32_t i_x0 = 0; i_x0 <= i_width - SSIM_WINDOW;
+		     i_x0 += SSIM_STRIDE) {
+			double f_mean_x = 0.0, f_mean_y = 0.0;
+			double f_xx = 0.0, f_yy = 0.0, f_xy = 0.0;
+			for (int32_t y = i_y0; y < i_y0 + SSIM_WINDOW; y++) {
+				for (int32_t x = i_x0; x < i_x0 + SSIM_WINDOW;
+				     x++) {
+					const size_t u_pixel =
+						static_cast<size_t>(y) *
+							i_width +
+						x;
+					const double f_a = v_x[u_pixel];
+					const double f_b = v_y[u_pixel];
+					f_mean_x += f_a;
+					f_mean_y += f_b;
+					f_xx += f_a * f_a;
+					f_yy += f_b * f_b;
+					f_xy += f_a * f_b;
+				}
+			}
+
+			const double f_n = SSIM_WINDOW * SSIM_WINDOW;
+			f_mean_x /= f_n;
+			f_mean_y /= f_n;
+			const double f_var_x = f_xx / f_n - f_mean_x * f_mean_x;
+			const double f_var_y = f_yy / f_n - f_mean_y * f_mean_y;
+			const double f_cov = f_xy / f_n - f_mean_x * f_mean_y;
+			f_sum += ((2.0 * f_mean_x * f_mean_y + SSIM_C1) *
+				  (2.0 * f_cov + SSIM_C2)) /
+				 ((f_mean_x * f_mean_x + f_mean_y * f_mean_y +
+				   SSIM_C1) *
+				  (f_var_x + f_var_y + SSIM_C2));
+			i_windows++;
+		}
+	}
+	return i_windows > 0 ? f_sum / i_windows : 1.0;
+}
+
+static ErrorMetrics compute_metrics(const float *p_image,
+				    const std::vector<float> &v_reference,
+				    const int32_t i_width,
+				    const int32_t i_height)
+{
+	double f_squared = 0.0;
+	double f_relative = 0.0;
+	const int64_t i_count = static_cast<int64_t>(v_reference.size());
+#pragma omp parallel for reduction(+ : f_squared, f_relative) schedule(static)
+	for (int64_t i = 0; i < i_count; i++) {
+		const double f_diff = p_image[i] - v_reference[i];
+		const double f_ref = v_reference[i];
+		f_squared += f_diff * f_diff;
+		f_relative +=
+			f_diff * f_diff / (f_ref * f_ref + REL_MSE_EPSILON);
+	}
+
+	ErrorMetrics S_metrics;
+	S_metrics.f_rmse = std::sqrt(f_squared / i_count);
+	S_metrics.f_rel_mse = f_relative / i_count;
+	S_metrics.f_ssim = compute_ssim(p_image, v_reference.data(), i_width,
+					i_height);
+	return S_metrics;
+}
+
+// Renders i_spp samples with both integrators from one seed. They draw the
+// same random numbers per pixel, so without the radiance cache their films
+// should agree up to float rounding.
+static bool compare_integrators(const std::string &s_scene_file,
+				const std::string &s_base_dir,
+				const int32_t i_size, const int32_t i_spp)
+{
+	std::array<std::vector<float>, 2> v_films;
+	for (int32_t i = 0; i < 2; i++) {
+		Renderer::Engine C_engine{ i_size, i_size, SCENE_AMBIENT,
+					   true };
+		C_engine.load_obj_scene(s_scene_file, s_base_dir);
+		C_engine.set_seed(COMPARE_SEED);
+		C_engine.use_wavefront_integrator(i == 1);
+		C_engine.render_samples(i_spp);
+		const Renderer::Film &S_film = C_engine.get_film();
+		v_films[i].assign(S_film.v_color.begin(), S_film.v_color.end());
+	}
+
+	const size_t u_pixel_count = static_cast<size_t>(i_size) * i_size;
+	size_t u_differing = 0;
+	double f_max_difference = 0.0;
+	double f_sum_recursive = 0.0;
+	double f_sum_wavefront = 0.0;
+	for (size_t u_pixel = 0; u_pixel < u_pixel_count; u_pixel++) {
+		bool b_differs = false;
+		for (int32_t c = 0; c < 3; c++) {
+			const double f_a = v_films[0][u_pixel * 3 + c];
+			const double f_b = v_films[1][u_pixel * 3 + c];
+			const double f_difference = std::abs(f_a - f_b);
+			const double f_tolerance =
+				COMPARE_PIXEL_TOLERANCE *
+				std::max(std::abs(f_a), 1.0);
+			f_max_difference =
+				std::max(f_max_difference, f_difference);
+			f_sum_recursive += f_a;
+			f_sum_wavefront += f_b;
+			b_differs = b_differs || f_difference > f_tolerance;
+		}
+		u_differing += b_differs ? 1 : 0;
+	}
+
+	const double f_differing =
+		static_cast<double>(u_differing) / u_pixel_count;
+	std::cout << "Recursive vs wavefront, " << i_spp << " spp, seed "
+		  << COMPARE_SEED << ": " << f_differing * 100.0
+		  << "% of pixels differ, max difference " << f_max_difference
+		  << ", mean " << f_sum_recursive / (u_pixel_count * 3)
+		  << " vs " << f_sum_wavefront / (u_pixel_count * 3) << "\n";
+	return f_differing <= COMPARE_MAX_DIFFERING;
+}
+
+static std::vector<double> parse_times(const std::string &s_list)
+{
+	std::vector<double> v_times;
+	std::istringstream t_list(s_list);
+	std::string s_item;
+	while (std::getline(t_list, s_item, ',')) {
+		v_times.push_back(std::stod(s_item));
+	}
+	return v_times;
+}
+
+static void write_csv(const std::string &s_path, const std::string &s_label,
+		      const std::vector<CurvePoint> &v_curve)
+{
+	std::ofstream t_file(s_path);
+	t_file << "label,checkpoint_s,render_s,samples,"
+		  "raw_rmse,raw_relmse,raw_ssim,"
+		  "oidn_rmse,oidn_relmse,oidn_ssim,oidn_s,"
+		  "custom_rmse,custom_relmse,custom_ssim\n";
+	for (const CurvePoint &S_point : v_curve) {
+		t_file << s_label << "," << S_point.f_checkpoint << ","
+		       << S_point.f_render_time << "," << S_point.i_samples
+		       << "," << S_point.S_raw.f_rmse << ","
+		       << S_point.S_raw.f_rel_mse << ","
+		       << S_point.S_raw.f_ssim << ","
+		       << S_point.S_oidn.f_rmse << ","
+		       << S_point.S_oidn.f_rel_mse << ","
+		       << S_point.S_oidn.f_ssim << "," << S_point.f_oidn_time
+		       << "," << S_point.S_custom.f_rmse << ","
+		       << S_point.S_custom.f_rel_mse << ","
+		       << S_point.S_custom.f_ssim << "\n";
+	}
+}
+
+static void write_json_metrics(std::ofstream &t_file,
+			       const ErrorMetrics &S_metrics)
+{
+	t_file << "{ \"rmse\": " << S_metrics.f_rmse
+	       << ", \"relmse\": " << S_metrics.f_rel_mse
+	       << ", \"ssim\": " << S_metrics.f_ssim << " }";
+}
+
+static void write_json(const std::string &s_path, const std::string &s_label,
+		       const int32_t i_size, const int32_t i_reference_spp,
+		       const std::vector<CurvePoint> &v_curve)
+{
+	std::ofstream t_file(s_path);
+	t_file << "{\n  \"label\": \"" << s_label << "\",\n  \"width\": "
+	       << i_size << ",\n  \"height\": " << i_size
+	       << ",\n  \"reference_spp\": " << i_reference_spp
+	       << ",\n  \"points\": [\n";
+	for (size_t i = 0; i < v_curve.size(); i++) {
+		const CurvePoint &S_point = v_curve[i];
+		t_file << "    { \"checkpoint_s\": " << S_point.f_checkpoint
+		       << ", \"render_s\": " << S_point.f_render_time
+		       << ", \"samples\": " << S_point.i_samples
+		       << ",\n      \"raw\": ";
+		write_json_metrics(t_file, S_point.S_raw);
+		t_file << ",\n      \"oidn\": ";
+		write_json_metrics(t_file, S_point.S_oidn);
+		t_file << ", \"oidn_s\": " << S_point.f_oidn_time
+		       << ",\n      \"custom\": ";
+		write_json_metrics(t_file, S_point.S_custom);
+		t_file << " }" << (i + 1 < v_curve.size() ? "," : "") << "\n";
+	}
+	t_file << "  ]\n}\n";
+}
+
+int main(int argc, char **argv)
+{
+	std::string s_input_file = "src/CornellBox.obj";
+	std::string s_base_dir;
+	int32_t i_size = 512;
+	int32_t i_reference_spp = 4096;
+	bool b_rebuild_reference = false;
+	std::vector<double> v_times{ 1.0, 2.0, 4.0, 8.0, 16.0, 32.0 };
+	std::string s_label = "default";
+	std::string s_output_prefix = "convergence";
+	bool b_wavefront = false;
+	float f_cache_cell_size = 0.0f;
+	int32_t i_compare_spp = 0;
+
+	for (int32_t i = 1; i < argc; i++) {
+		const bool b_has_value = i + 1 < argc;
+		if (!std::strcmp(argv[i], "--scene") && b_has_value) {
+			s_input_file = argv[++i];
+		} else if (!std::strcmp(argv[i], "--base-dir") &&
+			   b_has_value) {
+			s_base_dir = argv[++i];
+		} else if (!std::strcmp(argv[i], "--size") && b_has_value) {
+			i_size = std::stoi(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--reference-spp") &&
+			   b_has_value) {
+			i_reference_spp = std::stoi(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--rebuild-reference")) {
+			b_rebuild_reference = true;
+		} else if (!std::strcmp(argv[i], "--times") && b_has_value) {
+			v_times = parse_times(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--label") && b_has_value) {
+			s_label = argv[++i];
+		} else if (!std::strcmp(argv[i], "--output") && b_has_value) {
+			s_output_prefix = argv[++i];
+		} else if (!std::strcmp(argv[i], "--wavefront")) {
+			b_wavefront = true;
+		} else if (!std::strcmp(argv[i], "--radiance-cache") &&
+			   b_has_value) {
+			f_cache_cell_size = std::stof(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--compare-integrators") &&
+			   b_has_value) {
+			i_compare_spp = std::stoi(argv[++i]);
+		} else {
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Materials and textures resolve next to the scene by default.
+	if (s_base_dir.empty()) {
+		const size_t u_slash = s_input_file.find_last_of('/');
+		s_base_dir = u_slash == std::string::npos ?
+				     "./" :
+				     s_input_file.substr(0, u_slash + 1);
+	}
+
+	if (i_compare_spp > 0) {
+		return compare_integrators(s_input_file, s_base_dir, i_size,
+					   i_compare_spp) ?
+			       EXIT_SUCCESS :
+			       EXIT_FAILURE;
+	}
+
+	// The reference always uses the plain recursive integrator.
+	const std::string s_reference_file =
+		reference_file(s_input_file, i_size, i_reference_spp);
+	std::vector<float> v_reference;
+	if (b_rebuild_reference ||
+	    !read_pfm(s_reference_file, i_size, i_size, v_reference)) {
+		std::cout << "Rendering reference at " << i_reference_spp
+			  << " spp\n";
+		Renderer::Engine C_reference{ i_size, i_size,
+					      SCENE_AMBIENT, true };
+		C_reference.load_obj_scene(s_input_file, s_base_dir);
+		C_reference.render_samples(i_reference_spp);
+		const Renderer::Film &S_film = C_reference.get_film();
+		v_reference.assign(S_film.v_color.begin(),
+				   S_film.v_color.end());
+		write_pfm(s_reference_file, i_size, i_size,
+			  v_reference.data());
+	}
+
+	Renderer::Engine C_renderer{ i_size, i_size, SCENE_AMBIENT, true };
+	C_renderer.load_obj_scene(s_input_file, s_base_dir);
+	C_renderer.use_wavefront_integrator(b_wavefront);
+	if (f_cache_cell_size > 0.0f) {
+		Renderer::RadianceCacheConfig S_cache_config;
+		S_cache_config.f_cell_size = f_cache_cell_size;
+		C_renderer.enable_radiance_cache(S_cache_config);
+	}
+
+	C_renderer.allocate_film();
+
+	std::vector<CurvePoint> v_curve;
+	double f_render_time = 0.0;
+	size_t u_next = 0;
+	while (u_next < v_times.size()) {
+		const double f_pass_start = now_seconds();
+		C_renderer.render_pass();
+		f_render_time += now_seconds() - f_pass_start;
+		if (f_render_time < v_times[u_next]) {
+			continue;
+		}
+
+		const Renderer::Film &S_film = C_renderer.get_film();
+		CurvePoint S_point;
+		S_point.f_render_time = f_render_time;
+		S_point.i_samples = C_renderer.get_sample_count();
+		S_point.S_raw = compute_metrics(S_film.v_color.data(),
+						v_reference, i_size, i_size);
+
+		const double f_denoise_start = now_seconds();
+		C_renderer.oidn_denoise(false);
+		S_point.f_oidn_time = now_seconds() - f_denoise_start;
+		S_point.S_oidn = compute_metrics(S_film.v_denoised.data(),
+						 v_reference, i_size, i_size);
+
+		C_renderer.custom_denoise(false);
+		S_point.S_custom = compute_metrics(S_film.v_denoised.data(),
+						   v_reference, i_size, i_size);
+
+		// A slow pass can cross several checkpoints at once; each
+		// gets the same measurement so every run has the same rows.
+		while (u_next < v_times.size() &&
+		       f_render_time >= v_times[u_next]) {
+			S_point.f_checkpoint = v_times[u_next++];
+			v_curve.push_back(S_point);
+			std::cout << s_label << " @" << S_point.f_checkpoint
+				  << "s: " << S_point.i_samples
+				  << " spp, RMSE raw " << S_point.S_raw.f_rmse
+				  << " oidn " << S_point.S_oidn.f_rmse << "\n";
+		}
+	}
+
+	write_csv(s_output_prefix + ".csv", s_label, v_curve);
+	write_json(s_output_prefix + ".json", s_label, i_size,
+		   i_reference_spp, v_curve);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+#include "film.h"
+
+#include <algorithm>
+
+Renderer::Film::Film(const int32_t i_width, const int32_t i_height,
+		     const bool b_clear)
+	: i_width(i_width)
+	, i_height(i_height)
+	, v_color(pixel_count() * 3)
+	, v_albedo(pixel_count() * 3)
+	, v_normal(pixel_count() * 3)
+	, v_denoised(pixel_count() * 3)
+{
+	if (b_clear) {
+		clear_rows(0, i_height);
+	}
+}
+
+size_t Renderer::Film::pixel_count() const
+{
+	return static_cast<size_t>(i_width) * i_height;
+}
+
+void Renderer::Film::clear_rows(const int32_t i_y0, const int32_t i_y1)
+{
+	const size_t u_begin = static_cast<size_t>(i_y0) * i_width * 3;
+	const size_t u_end = static_cast<size_t>(i_y1) * i_width * 3;
+	std::fill(v_color.begin() + u_begin, v_color.begin() + u_end, 0.0f);
+	std::fill(v_albedo.begin() + u_begin, v_albedo.begin() + u_end, 0);
+	std::fill(v_normal.begin() + u_begin, v_normal.begin() + u_end, 0);
+	std::fill(v_denoised.begin() + u_begin, v_denoised.begin() + u_end,
+		  0.0f);
+}
+
+void Renderer::Film::move_rows(const int32_t i_y0, const int32_t i_y1,
+			       const int32_t i_dst_y0)
+{
+	const size_t u_row = static_cast<size_t>(i_width) * 3;
+	const auto move_plane = [&](auto &v_plane) {
+		const auto it_begin = v_plane.begin() + i_y0 * u_row;
+		const auto it_end = v_plane.begin() + i_y1 * u_row;
+		const auto it_dst = v_plane.begin() + i_dst_y0 * u_row;
+		if (i_dst_y0 > i_y0) {
+			std::copy_backward(it_begin, it_end,
+					   it_dst + (it_end - it_begin));
+		} else {
+			std::copy(it_begin, it_end, it_dst);
+		}
+	};
+	move_plane(v_color);
+	move_plane(v_albedo);
+	move_plane(v_normal);
+	move_plane(v_denoised);
+}
+
+std::vector<float> Renderer::Film::albedo_to_float() const
+{
+	std::vector<float> v_result(v_albedo.size());
+	half_to_float(v_albedo.data(), v_result.data(), v_albedo.size());
+	return v_result;
+}
+
+std::vector<float> Renderer::Film::normal_to_float() const
+{
+	std::vector<float> v_result(v_normal.size());
+	half_to_float(v_normal.data(), v_result.data(), v_normal.size());
+	return v_result;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "half.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace Renderer
+{
+template <typename T, size_t Alignment = 64> struct AlignedAllocator {
+	using value_type = T;
+
+	template <typename U> struct rebind {
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() = default;
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment> &)
+	{
+	}
+
+	T *allocate(size_t u_count)
+	{
+		return static_cast<T *>(::operator new(
+			u_count * sizeof(T), std::align_val_t(Alignment)));
+	}
+
+	void deallocate(T *p_data, size_t)
+	{
+		::operator delete(p_data, std::align_val_t(Alignment));
+	}
+
+	// Default-initializes, so sizing a vector leaves its pages untouched
+	// and the first write decides which NUMA node backs them.
+	template <typename U> void construct(U *p_data)
+	{
+		::new (static_cast<void *>(p_data)) U;
+	}
+
+	template <typename U, typename... Args>
+	void construct(U *p_data, Args &&...args)
+	{
+		::new (static_cast<void *>(p_data))
+			U(std::forward<Args>(args)...);
+	}
+
+	template <typename U>
+	bool operator==(const AlignedAllocator<U, Alignment> &) const
+	{
+		return true;
+	}
+};
+
+template <typename T> using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+/*
+Per-pixel render targets, laid out the way OIDN consumes them so denoising needs
+no staging copies: the accumulated color and the denoised output are linear
+Float3, albedo and normal are Half3. All planes start on a cache line.
+*/
+struct Film {
+	int32_t i_width;
+	int32_t i_height;
+
+	AlignedVector<float> v_color;
+	AlignedVector<uint16_t> v_albedo;
+	AlignedVector<uint16_t> v_normal;
+	AlignedVector<float> v_denoised;
+
+	// Without b_clear the planes are left untouched for the caller to
+	// first-touch with clear_rows.
+	Film(const int32_t i_width, const int32_t i_height,
+	     const bool b_clear = true);
+
+	size_t pixel_count() const;
+	void clear_rows(const int32_t i_y0, const int32_t i_y1);
+	// Copies rows [i_y0, i_y1) of every plane to start at row i_dst_y0.
+	// The ranges may overlap.
+	void move_rows(const int32_t i_y0, const int32_t i_y1,
+		       const int32_t i_dst_y0);
+
+	// Folds a sample into the running mean; i_sample_count includes it.
+	void accumulate(const size_t u_pixel, const glm::vec3 &vec_color,
+			const int32_t i_sample_count)
+	{
+		float *p_color = &v_color[u_pixel * 3];
+		for (int32_t c = 0; c < 3; c++) {
+			p_color[c] = (p_color[c] * (i_sample_count - 1) +
+				      vec_color[c]) /
+				     i_sample_count;
+		}
+	}
+
+	void set_color(const size_t u_pixel, const glm::vec3 &vec_color)
+	{
+		float *p_color = &v_color[u_pixel * 3];
+		p_color[0] = vec_color.r;
+		p_color[1] = vec_color.g;
+		p_color[2] = vec_color.b;
+	}
+
+	void set_aovs(const size_t u_pixel, const glm::vec3 &vec_albedo,
+		      const glm::vec3 &vec_normal)
+	{
+		store_half3(&v_albedo[u_pixel * 3], vec_albedo);
+		store_half3(&v_normal[u_pixel * 3], vec_normal);
+	}
+
+	std::vector<float> albedo_to_float() const;
+	std::vector<float> normal_to_float() const;
+};
+} // namespace Renderer
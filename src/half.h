@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <immintrin.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// FP16 helpers built on F16C. Half3 matches oidn::Format::Half3.
+
+inline void store_half3(uint16_t *p_dst, const glm::vec3 &vec_value)
+{
+	const __m128i v_half =
+		_mm_cvtps_ph(_mm_set_ps(0.0f, vec_value.z, vec_value.y,
+					vec_value.x),
+			     _MM_FROUND_TO_NEAREST_INT);
+	alignas(16) uint16_t a_half[8];
+	_mm_store_si128(reinterpret_cast<__m128i *>(a_half), v_half);
+	std::memcpy(p_dst, a_half, 3 * sizeof(uint16_t));
+}
+
+inline glm::vec3 load_half3(const uint16_t *p_src)
+{
+	alignas(16) uint16_t a_half[8] = {};
+	std::memcpy(a_half, p_src, 3 * sizeof(uint16_t));
+	const __m128i v_half =
+		_mm_load_si128(reinterpret_cast<const __m128i *>(a_half));
+	alignas(16) float a_float[4];
+	_mm_store_ps(a_float, _mm_cvtph_ps(v_half));
+	return glm::vec3(a_float[0], a_float[1], a_float[2]);
+}
+
+inline void half_to_float(const uint16_t *p_src, float *p_dst, size_t u_count)
+{
+	size_t i = 0;
+	for (; i + 8 <= u_count; i += 8) {
+		const __m128i v_half = _mm_loadu_si128(
+			reinterpret_cast<const __m128i *>(p_src + i));
+		_mm256_storeu_ps(p_dst + i, _mm256_cvtph_ps(v_half));
+	}
+	for (; i < u_count; i++) {
+		p_dst[i] = _cvtsh_ss(p_src[i]);
+	}
+}
+
+inline void float_to_half(const float *p_src, uint16_t *p_dst, size_t u_count)
+{
+	size_t i = 0;
+	for (; i + 8 <= u_count; i += 8) {
+		const __m128i v_half = _mm256_cvtps_ph(
+			_mm256_loadu_ps(p_src + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(p_dst + i),
+				 v_half);
+	}
+	for (; i < u_count; i++) {
+		p_dst[i] = _cvtss_sh(p_src[i], _MM_FROUND_TO_NEAREST_INT);
+	}
+}
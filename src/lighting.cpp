@@ -1,218 +1,505 @@
 #include "lighting.h"
+#include "radiance_cache.h"
+#include "sampler.h"
+#include "texture_cache.h"
 
 #include <cstdint>
 #include <cstring>
 #include <cfloat>
-#include <random>
+#include <algorithm>
+#include <cmath>
 
-static constexpr int32_t LIGHT_BOUNCE_DEPTH = 3;
-static constexpr int32_t SHADOW_SAMPLES = 64;
 static constexpr glm::vec3 LIGHT_POS(-278.0f, 548.0f, -279.6f);
 static constexpr glm::vec3 LIGHT_COLOR(0xff / 255.0f, 0xbb / 255.0f,
 				       0x73 / 255.0f);
-static constexpr float LIGHT_INTENSITY = 5.0f;
+// Emitted radiance of the area light, scaled by LIGHT_COLOR.
+static constexpr float LIGHT_INTENSITY = 50.0f;
 static constexpr float LIGHT_WIDTH = 200.0f;
 static constexpr float LIGHT_HEIGHT = 225.0f;
+static constexpr float LIGHT_AREA = LIGHT_WIDTH * LIGHT_HEIGHT;
+static constexpr float PI = 3.14159265f;
+// Caps how far a grazing hit stretches the ray cone's footprint.
+static constexpr float MIN_CONE_COSINE = 0.05f;
 
-static glm::vec3 cosine_weighted_sample(const glm::vec3 &normal)
+static thread_local Sampler S_sampler;
+
+static void build_basis(const glm::vec3 &normal, glm::vec3 &tangent,
+			glm::vec3 &bitangent)
 {
-	static thread_local std::mt19937 rng{ std::random_device{}() };
-	static thread_local std::uniform_real_distribution<float> dist(0.0f,
-								       1.0f);
+	if (std::abs(normal.x) > std::abs(normal.z))
+		tangent = glm::normalize(glm::vec3(-normal.y, normal.x, 0.0f));
+	else
+		tangent = glm::normalize(glm::vec3(0.0f, -normal.z, normal.y));
+	bitangent = glm::cross(normal, tangent);
+}
 
-	const float u1 = dist(rng);
-	const float u2 = dist(rng);
+static glm::vec3 cosine_weighted_sample(const glm::vec3 &normal,
+					Sampler &S_rng)
+{
+	const float u1 = S_rng.next_float();
+	const float u2 = S_rng.next_float();
 	const float r = sqrt(u1);
-	const float theta = 2.0f * 3.14159265f * u2;
+	const float theta = 2.0f * PI * u2;
 	const float sample_x = r * cos(theta);
 	const float sample_y = r * sin(theta);
 	const float sample_z = sqrt(1.0f - u1);
 
 	glm::vec3 tangent, bitangent;
-	if (std::abs(normal.x) > std::abs(normal.z))
-		tangent = glm::normalize(glm::vec3(-normal.y, normal.x, 0.0f));
-	else
-		tangent = glm::normalize(glm::vec3(0.0f, -normal.z, normal.y));
-	bitangent = glm::cross(normal, tangent);
+	build_basis(normal, tangent, bitangent);
 
 	glm::vec3 sample =
 		sample_x * tangent + sample_y * bitangent + sample_z * normal;
 	return glm::normalize(sample);
 }
 
-static glm::vec3
-trace_ray_recursive(const RTCScene &p_scene, const RTCDevice &p_device,
-		    const glm::vec3 &ray_origin, const glm::vec3 &ray_direction,
-		    int i_depth,
-		    const std::vector<tinyobj::material_t> &vec_materials,
-		    float f_ambient_strength)
+// Samples cos^n around the mirror direction.
+static glm::vec3 phong_lobe_sample(const glm::vec3 &reflection_dir,
+				   float f_exponent, Sampler &S_rng)
 {
-	if (i_depth <= 0) {
-		return glm::vec3(0.0f);
-	}
+	const float u1 = S_rng.next_float();
+	const float u2 = S_rng.next_float();
+	const float cos_alpha = pow(u1, 1.0f / (f_exponent + 1.0f));
+	const float sin_alpha =
+		sqrt(std::max(0.0f, 1.0f - cos_alpha * cos_alpha));
+	const float phi = 2.0f * PI * u2;
 
-	RTCRayHit t_ray_hit;
-	std::memset(&t_ray_hit, 0, sizeof(t_ray_hit));
+	glm::vec3 tangent, bitangent;
+	build_basis(reflection_dir, tangent, bitangent);
 
-	t_ray_hit.ray.org_x = ray_origin.x;
-	t_ray_hit.ray.org_y = ray_origin.y;
-	t_ray_hit.ray.org_z = ray_origin.z;
-	t_ray_hit.ray.dir_x = ray_direction.x;
-	t_ray_hit.ray.dir_y = ray_direction.y;
-	t_ray_hit.ray.dir_z = ray_direction.z;
-	t_ray_hit.ray.tnear = 0.001f;
-	t_ray_hit.ray.tfar = FLT_MAX;
-	t_ray_hit.ray.mask = -1;
-	t_ray_hit.ray.flags = 0;
-	t_ray_hit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-	t_ray_hit.hit.primID = RTC_INVALID_GEOMETRY_ID;
+	return glm::normalize(sin_alpha * cos(phi) * tangent +
+			      sin_alpha * sin(phi) * bitangent +
+			      cos_alpha * reflection_dir);
+}
 
-	RTCIntersectContext t_context;
-	rtcInitIntersectContext(&t_context);
-	rtcIntersect1(p_scene, &t_context, &t_ray_hit);
+static float luminance(const glm::vec3 &color)
+{
+	return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+}
 
-	if (t_ray_hit.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
-		return glm::vec3(0.0f);
-	}
+float lighting::power_heuristic(int32_t i_count_a, float f_pdf_a,
+			       int32_t i_count_b, float f_pdf_b)
+{
+	const float f_a = i_count_a * f_pdf_a;
+	const float f_b = i_count_b * f_pdf_b;
+	const float f_a2 = f_a * f_a;
+	const float f_b2 = f_b * f_b;
+	return f_a2 + f_b2 > 0.0f ? f_a2 / (f_a2 + f_b2) : 0.0f;
+}
 
-	glm::vec3 hit_point = ray_origin + ray_direction * t_ray_hit.ray.tfar;
-	glm::vec3 normal = glm::normalize(glm::vec3(
-		t_ray_hit.hit.Ng_x, t_ray_hit.hit.Ng_y, t_ray_hit.hit.Ng_z));
+float lighting::specular_probability(const Material &S_material)
+{
+	const float f_diffuse = luminance(S_material.diffuse);
+	const float f_specular = luminance(S_material.specular);
+	return f_diffuse + f_specular > 0.0f ?
+		       f_specular / (f_diffuse + f_specular) :
+		       0.0f;
+}
 
-	RTCGeometry p_geom = rtcGetGeometry(p_scene, t_ray_hit.hit.geomID);
-	GeometryUserData *p_user_data =
-		(GeometryUserData *)rtcGetGeometryUserData(p_geom);
-	const tinyobj::mesh_t *p_mesh = p_user_data->mesh_ptr;
-	unsigned int ui_prim_id = t_ray_hit.hit.primID;
-	int i_mat_id = 0;
-	if (ui_prim_id < p_mesh->material_ids.size()) {
-		i_mat_id = p_mesh->material_ids[ui_prim_id];
+glm::vec3 lighting::evaluate_bsdf(const Material &S_material,
+				  const glm::vec3 &vec_normal,
+				  const glm::vec3 &vec_view_dir,
+				  const glm::vec3 &vec_light_dir)
+{
+	glm::vec3 vec_value = S_material.diffuse / PI;
+	if (luminance(S_material.specular) > 0.0f) {
+		const glm::vec3 reflection_dir =
+			glm::reflect(-vec_view_dir, vec_normal);
+		const float f_cos_alpha =
+			std::max(0.0f, glm::dot(reflection_dir, vec_light_dir));
+		vec_value += S_material.specular *
+			     ((S_material.f_shininess + 2.0f) / (2.0f * PI)) *
+			     pow(f_cos_alpha, S_material.f_shininess);
 	}
+	return vec_value;
+}
 
-	glm::vec3 diffuse_color(1.0f, 0.0f, 1.0f);
-	glm::vec3 specular_color(0.0f);
-	glm::vec3 emissive_color(0.0f);
-	if (i_mat_id >= 0 &&
-	    i_mat_id < static_cast<int>(vec_materials.size())) {
-		const tinyobj::material_t &mat = vec_materials[i_mat_id];
-		diffuse_color = glm::vec3(mat.diffuse[0], mat.diffuse[1],
-					  mat.diffuse[2]);
-		specular_color = glm::vec3(mat.specular[0], mat.specular[1],
-					   mat.specular[2]);
-		emissive_color = glm::vec3(mat.emission[0], mat.emission[1],
-					   mat.emission[2]);
+float lighting::bsdf_pdf(const Material &S_material,
+			 const glm::vec3 &vec_normal,
+			 const glm::vec3 &vec_view_dir,
+			 const glm::vec3 &vec_light_dir)
+{
+	const float f_cos_theta = glm::dot(vec_normal, vec_light_dir);
+	if (f_cos_theta <= 0.0f) {
+		return 0.0f;
 	}
 
-	glm::vec3 direct = lighting::compute_lambert_color(
-		normal, hit_point, diffuse_color, p_scene, f_ambient_strength);
+	const float f_spec_prob = specular_probability(S_material);
+	float f_pdf = (1.0f - f_spec_prob) * f_cos_theta / PI;
+	if (f_spec_prob > 0.0f) {
+		const glm::vec3 reflection_dir =
+			glm::reflect(-vec_view_dir, vec_normal);
+		const float f_cos_alpha =
+			std::max(0.0f, glm::dot(reflection_dir, vec_light_dir));
+		f_pdf += f_spec_prob *
+			 ((S_material.f_shininess + 1.0f) / (2.0f * PI)) *
+			 pow(f_cos_alpha, S_material.f_shininess);
+	}
+	return f_pdf;
+}
 
-	glm::vec3 new_ray_dir = cosine_weighted_sample(normal);
-	glm::vec3 indirect = trace_ray_recursive(
-		p_scene, p_device, hit_point + 0.001f * normal, new_ray_dir,
-		i_depth - 1, vec_materials, f_ambient_strength);
+glm::vec3 lighting::sample_bsdf_direction(const Material &S_material,
+					  const glm::vec3 &vec_normal,
+					  const glm::vec3 &vec_view_dir,
+					  Sampler &S_rng)
+{
+	if (S_rng.next_float() < specular_probability(S_material)) {
+		const glm::vec3 reflection_dir =
+			glm::reflect(-vec_view_dir, vec_normal);
+		return phong_lobe_sample(reflection_dir,
+					 S_material.f_shininess, S_rng);
+	}
+	return cosine_weighted_sample(vec_normal, S_rng);
+}
 
-	glm::vec3 reflection_dir = glm::reflect(-ray_direction, normal);
-	glm::vec3 specular_radiance = trace_ray_recursive(
-		p_scene, p_device, hit_point + 0.001f * normal, reflection_dir,
-		i_depth - 1, vec_materials, f_ambient_strength);
+lighting::RayCone lighting::camera_ray_cone(const Camera &S_camera,
+					    int32_t i_height)
+{
+	const float f_pixel_height = S_camera.f_viewport_height /
+				     static_cast<float>(i_height - 1);
+	return RayCone{ 0.0f, f_pixel_height / S_camera.f_focal_length };
+}
 
-	constexpr float f_diffuse_coeff = 0.8f;
-	constexpr float f_specular_coeff = 0.5f;
+lighting::RayCone lighting::bounce_ray_cone(const RayCone &S_cone,
+					    float f_hit_t,
+					    const Material &S_material)
+{
+	// A cos^n lobe is about 1 / sqrt(n + 1) radians wide; the Lambert
+	// lobe is the n = 1 case.
+	const float f_diffuse_width = 1.0f / std::sqrt(2.0f);
+	const float f_specular_width =
+		1.0f / std::sqrt(S_material.f_shininess + 1.0f);
+	const float f_lobe_width =
+		glm::mix(f_diffuse_width, f_specular_width,
+			 specular_probability(S_material));
+	return RayCone{ S_cone.f_width + S_cone.f_spread * f_hit_t,
+			S_cone.f_spread + f_lobe_width };
+}
 
-	glm::vec3 final_radiance =
-		emissive_color + direct + f_diffuse_coeff * indirect +
-		specular_color * f_specular_coeff * specular_radiance;
-	return final_radiance;
+glm::vec3 lighting::light_radiance()
+{
+	return LIGHT_COLOR * LIGHT_INTENSITY;
 }
 
-static std::vector<glm::vec2> generate_stratified_offsets(int32_t i_num_samples,
-							  float f_light_width,
-							  float f_light_height)
+float lighting::intersect_light(const glm::vec3 &ray_origin,
+				const glm::vec3 &ray_direction)
 {
-	static thread_local std::mt19937 rng{ std::random_device{}() };
+	if (ray_direction.y <= 0.0f) {
+		return FLT_MAX;
+	}
 
-	int32_t grid_size = static_cast<int32_t>(sqrt(i_num_samples));
-	float cell_width = f_light_width / grid_size;
-	float cell_height = f_light_height / grid_size;
+	const float f_t = (LIGHT_POS.y - ray_origin.y) / ray_direction.y;
+	if (f_t <= 0.001f) {
+		return FLT_MAX;
+	}
 
-	std::vector<glm::vec2> offsets(i_num_samples);
-	std::uniform_real_distribution<float> jitter(0.0f, 1.0f);
+	const glm::vec3 vec_hit = ray_origin + ray_direction * f_t;
+	if (std::abs(vec_hit.x - LIGHT_POS.x) > LIGHT_WIDTH * 0.5f ||
+	    std::abs(vec_hit.z - LIGHT_POS.z) > LIGHT_HEIGHT * 0.5f) {
+		return FLT_MAX;
+	}
+	return f_t;
+}
 
-	int32_t index = 0;
-	for (int32_t i = 0; i < grid_size && index < i_num_samples; i++) {
-		for (int32_t j = 0; j < grid_size && index < i_num_samples;
-		     j++) {
-			float base_x = (i + jitter(rng)) * cell_width -
-				       f_light_width * 0.5f;
-			float base_z = (j + jitter(rng)) * cell_height -
-				       f_light_height * 0.5f;
+float lighting::light_pdf(float f_dist, const glm::vec3 &vec_light_dir)
+{
+	const float f_cos_light = vec_light_dir.y;
+	return f_dist * f_dist / (f_cos_light * LIGHT_AREA);
+}
 
-			offsets[index++] = glm::vec2(base_x, base_z);
-		}
+bool lighting::sample_light(const glm::vec3 &vec_origin, int32_t i_stratum,
+			    Sampler &S_rng, LightSample &S_sample)
+{
+	static constexpr int32_t i_grid =
+		SHADOW_SAMPLES == 1 ? 1 : (SHADOW_SAMPLES >= 16 ? 4 : 2);
+	static_assert(i_grid * i_grid == SHADOW_SAMPLES,
+		      "SHADOW_SAMPLES must be 1, 4 or 16");
+
+	const float f_su =
+		((i_stratum % i_grid) + S_rng.next_float()) / i_grid;
+	const float f_sv =
+		((i_stratum / i_grid) + S_rng.next_float()) / i_grid;
+	const glm::vec3 vec_light_point =
+		LIGHT_POS + glm::vec3((f_su - 0.5f) * LIGHT_WIDTH, 0.0f,
+				      (f_sv - 0.5f) * LIGHT_HEIGHT);
+
+	S_sample.vec_dir = vec_light_point - vec_origin;
+	S_sample.f_dist = glm::length(S_sample.vec_dir);
+	S_sample.vec_dir /= S_sample.f_dist;
+	if (S_sample.vec_dir.y <= 0.0f) {
+		return false;
 	}
+	S_sample.f_pdf = light_pdf(S_sample.f_dist, S_sample.vec_dir);
+	return true;
+}
+
+glm::vec3 lighting::camera_ray_direction(const Camera &S_camera,
+					 int32_t i_pixel_x, int32_t i_pixel_y,
+					 int32_t i_width, int32_t i_height)
+{
+	const float f_u =
+		static_cast<float>(i_pixel_x) / static_cast<float>(i_width - 1);
+	const float f_v = static_cast<float>(i_pixel_y) /
+			  static_cast<float>(i_height - 1);
+	const glm::vec3 vec_pixel_position =
+		S_camera.vec_lower_left_corner +
+		S_camera.vec_right * (f_u * S_camera.f_viewport_width) +
+		S_camera.vec_up * (f_v * S_camera.f_viewport_height);
+	return glm::normalize(vec_pixel_position - S_camera.vec_camera_origin);
+}
 
-	for (int32_t i = offsets.size() - 1; i > 0; i--) {
-		int32_t j = std::uniform_int_distribution<int32_t>(0, i)(rng);
-		std::swap(offsets[i], offsets[j]);
+int32_t lighting::material_index(const tinyobj::mesh_t *p_mesh,
+				 unsigned int ui_prim_id,
+				 size_t u_num_materials)
+{
+	int32_t i_mat_id = 0;
+	if (ui_prim_id < p_mesh->material_ids.size()) {
+		i_mat_id = p_mesh->material_ids[ui_prim_id];
 	}
+	if (i_mat_id < 0 || static_cast<size_t>(i_mat_id) >= u_num_materials) {
+		return -1;
+	}
+	return i_mat_id;
+}
 
-	return offsets;
+Material lighting::fetch_material(
+	const std::vector<tinyobj::material_t> &vec_materials,
+	const tinyobj::mesh_t *p_mesh, unsigned int ui_prim_id)
+{
+	const int32_t i_mat_id =
+		material_index(p_mesh, ui_prim_id, vec_materials.size());
+
+	Material S_material;
+	S_material.diffuse = glm::vec3(1.0f, 0.0f, 1.0f);
+	S_material.specular = glm::vec3(0.0f);
+	S_material.emission = glm::vec3(0.0f);
+	S_material.f_shininess = 1.0f;
+	if (i_mat_id >= 0) {
+		const tinyobj::material_t &mat = vec_materials[i_mat_id];
+		S_material.diffuse = glm::vec3(mat.diffuse[0], mat.diffuse[1],
+					       mat.diffuse[2]);
+		S_material.specular = glm::vec3(
+			mat.specular[0], mat.specular[1], mat.specular[2]);
+		S_material.emission = glm::vec3(
+			mat.emission[0], mat.emission[1], mat.emission[2]);
+		S_material.f_shininess = std::max(mat.shininess, 1.0f);
+	}
+	return S_material;
 }
 
-static float smoothstep(float edge0, float edge1, float x)
+Material lighting::fetch_textured_material(const Scene &S_scene,
+					   const tinyobj::mesh_t *p_mesh,
+					   const RTCHit &S_hit,
+					   const glm::vec3 &vec_ray_dir,
+					   float f_cone_width)
 {
-	float t = glm::clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
-	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+	Material S_material =
+		fetch_material(S_scene.v_materials, p_mesh, S_hit.primID);
+	Renderer::TextureCache *p_textures = S_scene.p_texture_cache;
+	const int32_t i_mat_id = material_index(p_mesh, S_hit.primID,
+						S_scene.v_materials.size());
+	if (!p_textures || i_mat_id < 0) {
+		return S_material;
+	}
+	const MaterialTextures &S_textures =
+		S_scene.v_material_textures[i_mat_id];
+	if (S_textures.i_diffuse < 0 && S_textures.i_specular < 0 &&
+	    S_textures.i_emission < 0) {
+		return S_material;
+	}
+
+	const tinyobj::index_t *p_index = &p_mesh->indices[3 * S_hit.primID];
+	glm::vec2 a_uv[3];
+	glm::vec3 a_position[3];
+	for (int32_t k = 0; k < 3; k++) {
+		const int32_t i_texcoord = p_index[k].texcoord_index;
+		if (i_texcoord < 0) {
+			return S_material;
+		}
+		const float *p_uv = &S_scene.S_attrib.texcoords[2 * i_texcoord];
+		const float *p_position =
+			&S_scene.S_attrib
+				 .vertices[3 * p_index[k].vertex_index];
+		a_uv[k] = glm::vec2(p_uv[0], p_uv[1]);
+		a_position[k] =
+			glm::vec3(p_position[0], p_position[1], p_position[2]);
+	}
+	const glm::vec2 vec_uv = (1.0f - S_hit.u - S_hit.v) * a_uv[0] +
+				 S_hit.u * a_uv[1] + S_hit.v * a_uv[2];
+
+	// The cone's width on the surface, scaled from world to UV units by
+	// the ratio of the triangle's areas in both spaces.
+	const glm::vec2 vec_uv_1 = a_uv[1] - a_uv[0];
+	const glm::vec2 vec_uv_2 = a_uv[2] - a_uv[0];
+	const float f_uv_area =
+		std::abs(vec_uv_1.x * vec_uv_2.y - vec_uv_1.y * vec_uv_2.x);
+	const glm::vec3 vec_cross = glm::cross(a_position[1] - a_position[0],
+					       a_position[2] - a_position[0]);
+	const float f_world_area = glm::length(vec_cross);
+	float f_footprint = 0.0f;
+	if (f_world_area > 0.0f) {
+		const float f_cos = std::abs(
+			glm::dot(vec_cross / f_world_area, vec_ray_dir));
+		f_footprint = f_cone_width / std::max(f_cos, MIN_CONE_COSINE) *
+			      std::sqrt(f_uv_area / f_world_area);
+	}
+
+	// As in MTL, the maps scale the constant colors.
+	if (S_textures.i_diffuse >= 0) {
+		S_material.diffuse *= p_textures->sample(
+			S_textures.i_diffuse, vec_uv, f_footprint);
+	}
+	if (S_textures.i_specular >= 0) {
+		S_material.specular *= p_textures->sample(
+			S_textures.i_specular, vec_uv, f_footprint);
+	}
+	if (S_textures.i_emission >= 0) {
+		S_material.emission *= p_textures->sample(
+			S_textures.i_emission, vec_uv, f_footprint);
+	}
+	return S_material;
 }
 
-static float compute_shadow_factor(const RTCScene &p_scene,
-				   const glm::vec3 &vec_point,
-				   const glm::vec3 &vec_light_pos,
-				   float f_light_width, float f_light_height,
-				   int32_t i_num_samples = 32)
+static glm::vec3
+trace_ray_recursive(const Scene &S_scene, const RTCDevice &p_device,
+		    const glm::vec3 &ray_origin, const glm::vec3 &ray_direction,
+		    int i_depth, const lighting::RayCone &S_cone,
+		    float f_bsdf_pdf);
+
+// Radiance leaving the surface hit by t_ray_hit, given its already fetched
+// material. Split from trace_ray_recursive so camera hits, whose material is
+// also needed for the albedo AOV, are not looked up twice.
+static glm::vec3 shade_hit(const Scene &S_scene, const RTCDevice &p_device,
+			   const glm::vec3 &ray_origin,
+			   const glm::vec3 &ray_direction,
+			   const RTCRayHit &t_ray_hit,
+			   const Material &S_material, int i_depth,
+			   const lighting::RayCone &S_cone, float f_bsdf_pdf)
 {
-	static thread_local std::vector<glm::vec2> precomputed_offsets;
-	if (precomputed_offsets.size() != static_cast<size_t>(i_num_samples)) {
-		precomputed_offsets = generate_stratified_offsets(
-			i_num_samples, f_light_width, f_light_height);
+	Renderer::RadianceCache *p_cache = S_scene.p_radiance_cache;
+
+	glm::vec3 hit_point = ray_origin + ray_direction * t_ray_hit.ray.tfar;
+	glm::vec3 normal = glm::normalize(glm::vec3(
+		t_ray_hit.hit.Ng_x, t_ray_hit.hit.Ng_y, t_ray_hit.hit.Ng_z));
+	if (glm::dot(normal, ray_direction) > 0.0f) {
+		normal = -normal;
+	}
+	const glm::vec3 view_dir = -ray_direction;
+
+	// Secondary hits on mostly diffuse surfaces reuse cached radiance and
+	// end the path there. Camera hits are never cached, so the cache's
+	// grid does not show up directly in the image.
+	const bool b_cacheable = p_cache && f_bsdf_pdf > 0.0f &&
+				 lighting::specular_probability(S_material) <
+					 lighting::MAX_CACHED_SPECULAR;
+	glm::vec3 cached;
+	if (b_cacheable && p_cache->lookup(hit_point, normal, cached)) {
+		return cached;
 	}
 
-	static thread_local RTCIntersectContext shadow_context;
-
-	float f_shadow_sum = 0.0f;
-	for (int32_t i = 0; i < i_num_samples; i++) {
-		const glm::vec2 &offset = precomputed_offsets[i];
-		glm::vec3 sample_light_pos =
-			vec_light_pos + glm::vec3(offset.x, 0.0f, offset.y);
-		glm::vec3 sample_dir = sample_light_pos - vec_point;
-		float f_sample_dist = glm::length(sample_dir);
-		sample_dir = glm::normalize(sample_dir);
-
-		RTCRayHit t_shadow_hit;
-		std::memset(&t_shadow_hit, 0, sizeof(t_shadow_hit));
-		t_shadow_hit.ray.org_x = vec_point.x;
-		t_shadow_hit.ray.org_y = vec_point.y;
-		t_shadow_hit.ray.org_z = vec_point.z;
-		t_shadow_hit.ray.dir_x = sample_dir.x;
-		t_shadow_hit.ray.dir_y = sample_dir.y;
-		t_shadow_hit.ray.dir_z = sample_dir.z;
-		t_shadow_hit.ray.tnear = 0.001f;
-		t_shadow_hit.ray.tfar = f_sample_dist - 0.001f;
-		t_shadow_hit.ray.mask = -1;
-		t_shadow_hit.ray.flags = 0;
-		rtcInitIntersectContext(&shadow_context);
-		rtcIntersect1(p_scene, &shadow_context, &t_shadow_hit);
-
-		float sample_shadow = 1.0f;
-		if (t_shadow_hit.hit.geomID != RTC_INVALID_GEOMETRY_ID) {
-			float hit_distance = t_shadow_hit.ray.tfar;
-			sample_shadow =
-				1.0f - smoothstep(0.0f, 0.15f * f_sample_dist,
-						  f_sample_dist - hit_distance);
+	// The last vertex has no BSDF continuation, so light sampling
+	// carries the full weight there.
+	const bool b_continue = i_depth > 1;
+	glm::vec3 direct = lighting::compute_direct_light(
+		normal, hit_point, view_dir, S_material, S_scene.p_RTCscene,
+		b_continue, S_sampler);
+	glm::vec3 ambient = S_material.diffuse * S_scene.f_ambient_intensity;
+
+	glm::vec3 indirect(0.0f);
+	if (b_continue) {
+		const glm::vec3 new_ray_dir = lighting::sample_bsdf_direction(
+			S_material, normal, view_dir, S_sampler);
+		const float f_cos_theta = glm::dot(normal, new_ray_dir);
+		const float f_pdf = lighting::bsdf_pdf(S_material, normal,
+						       view_dir, new_ray_dir);
+		if (f_cos_theta > 0.0f && f_pdf > 0.0f) {
+			const glm::vec3 throughput =
+				lighting::evaluate_bsdf(S_material, normal,
+							view_dir,
+							new_ray_dir) *
+				(f_cos_theta / f_pdf);
+			const lighting::RayCone S_next_cone =
+				lighting::bounce_ray_cone(
+					S_cone, t_ray_hit.ray.tfar, S_material);
+			indirect = throughput *
+				   trace_ray_recursive(
+					   S_scene, p_device,
+					   hit_point + 0.001f * normal,
+					   new_ray_dir, i_depth - 1,
+					   S_next_cone, f_pdf);
 		}
-		f_shadow_sum += sample_shadow;
 	}
-	return f_shadow_sum / static_cast<float>(i_num_samples);
+
+	const glm::vec3 radiance =
+		S_material.emission + ambient + direct + indirect;
+	// Only vertices that traced a bounce of their own are stored, so
+	// cells are not filled with direct light alone.
+	if (b_cacheable && b_continue) {
+		p_cache->insert(hit_point, normal, radiance);
+	}
+	return radiance;
+}
+
+static glm::vec3
+trace_ray_recursive(const Scene &S_scene, const RTCDevice &p_device,
+		    const glm::vec3 &ray_origin, const glm::vec3 &ray_direction,
+		    int i_depth, const lighting::RayCone &S_cone,
+		    float f_bsdf_pdf)
+{
+	if (i_depth <= 0) {
+		return glm::vec3(0.0f);
+	}
+
+	const RTCScene &p_scene = S_scene.p_RTCscene;
+
+	RTCRayHit t_ray_hit;
+	std::memset(&t_ray_hit, 0, sizeof(t_ray_hit));
+
+	t_ray_hit.ray.org_x = ray_origin.x;
+	t_ray_hit.ray.org_y = ray_origin.y;
+	t_ray_hit.ray.org_z = ray_origin.z;
+	t_ray_hit.ray.dir_x = ray_direction.x;
+	t_ray_hit.ray.dir_y = ray_direction.y;
+	t_ray_hit.ray.dir_z = ray_direction.z;
+	t_ray_hit.ray.tnear = 0.001f;
+	t_ray_hit.ray.tfar = FLT_MAX;
+	t_ray_hit.ray.mask = -1;
+	t_ray_hit.ray.flags = 0;
+	t_ray_hit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+	t_ray_hit.hit.primID = RTC_INVALID_GEOMETRY_ID;
+
+	RTCIntersectContext t_context;
+	rtcInitIntersectContext(&t_context);
+	rtcIntersect1(p_scene, &t_context, &t_ray_hit);
+
+	// The area light is not part of the Embree scene, so emitter hits
+	// from BSDF sampling are found analytically and MIS weighted against
+	// light sampling. Camera rays (pdf 0) see it unweighted.
+	const float f_light_t =
+		lighting::intersect_light(ray_origin, ray_direction);
+	if (f_light_t < t_ray_hit.ray.tfar) {
+		const float f_weight =
+			f_bsdf_pdf > 0.0f ?
+				lighting::power_heuristic(
+					1, f_bsdf_pdf,
+					lighting::SHADOW_SAMPLES,
+					lighting::light_pdf(f_light_t,
+							    ray_direction)) :
+				1.0f;
+		return lighting::light_radiance() * f_weight;
+	}
+
+	if (t_ray_hit.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
+		return glm::vec3(0.0f);
+	}
+
+	RTCGeometry p_geom = rtcGetGeometry(p_scene, t_ray_hit.hit.geomID);
+	GeometryUserData *p_user_data =
+		(GeometryUserData *)rtcGetGeometryUserData(p_geom);
+	const Material S_material = lighting::fetch_textured_material(
+		S_scene, p_user_data->mesh_ptr, t_ray_hit.hit, ray_direction,
+		S_cone.f_width + S_cone.f_spread * t_ray_hit.ray.tfar);
+	return shade_hit(S_scene, p_device, ray_origin, ray_direction,
+			 t_ray_hit, S_material, i_depth, S_cone, f_bsdf_pdf);
 }
 
 bool lighting::is_in_shadow(const RTCScene &p_scene, const glm::vec3 &vec_point,
@@ -244,55 +531,58 @@ bool lighting::is_in_shadow(const RTCScene &p_scene, const glm::vec3 &vec_point,
 	return (S_shadow_ray.ray.tfar < 0.0f);
 }
 
-glm::vec3 lighting::compute_lambert_color(const glm::vec3 &vec_normal,
-					  const glm::vec3 &vec_point,
-					  const glm::vec3 &vec_material_color,
-					  RTCScene p_scene,
-					  float f_ambient_strength)
+glm::vec3 lighting::compute_direct_light(const glm::vec3 &vec_normal,
+					 const glm::vec3 &vec_point,
+					 const glm::vec3 &vec_view_dir,
+					 const Material &S_material,
+					 RTCScene p_scene, bool b_use_mis,
+					 Sampler &S_rng)
 {
-	glm::vec3 vec_ambient = vec_material_color * f_ambient_strength;
+	const glm::vec3 vec_origin = vec_point + 0.001f * vec_normal;
+	glm::vec3 vec_radiance(0.0f);
 
-	glm::vec3 vec_light_dir = LIGHT_POS - vec_point;
-	float f_dist_to_light = glm::length(vec_light_dir);
-	vec_light_dir = glm::normalize(vec_light_dir);
+	for (int32_t i = 0; i < SHADOW_SAMPLES; i++) {
+		LightSample S_light;
+		if (!sample_light(vec_origin, i, S_rng, S_light)) {
+			continue;
+		}
+		const float f_n_dot_l = glm::dot(vec_normal, S_light.vec_dir);
+		if (f_n_dot_l <= 0.0f) {
+			continue;
+		}
+		if (is_in_shadow(p_scene, vec_origin, S_light.vec_dir,
+				 S_light.f_dist)) {
+			continue;
+		}
 
-	const float f_n_dot_l = glm::dot(vec_normal, vec_light_dir);
-	if (f_n_dot_l <= 0.0f) {
-		return vec_ambient;
+		const float f_weight =
+			b_use_mis ? power_heuristic(
+					    SHADOW_SAMPLES, S_light.f_pdf, 1,
+					    bsdf_pdf(S_material, vec_normal,
+						     vec_view_dir,
+						     S_light.vec_dir)) :
+				    1.0f;
+		vec_radiance += evaluate_bsdf(S_material, vec_normal,
+					      vec_view_dir, S_light.vec_dir) *
+				light_radiance() *
+				(f_n_dot_l * f_weight / S_light.f_pdf);
 	}
 
-	const bool b_occluded = is_in_shadow(p_scene,
-					     vec_point + 0.001f * vec_normal,
-					     vec_light_dir, f_dist_to_light);
-	// if (b_occluded) {
-	// 	return vec_ambient;
-	// }
-
-	const float f_shadow_factor = compute_shadow_factor(
-		p_scene, vec_point + 0.001f * vec_normal, LIGHT_POS,
-		LIGHT_WIDTH, LIGHT_HEIGHT, SHADOW_SAMPLES);
-
-	const float f_lambert_term = f_n_dot_l * LIGHT_INTENSITY;
-	glm::vec3 vec_lit_color = vec_material_color * LIGHT_COLOR *
-				  f_lambert_term * f_shadow_factor;
-
-	return glm::clamp(vec_ambient + vec_lit_color, 0.0f, 1.0f);
+	return vec_radiance / static_cast<float>(SHADOW_SAMPLES);
 }
 
 SurfaceInfo lighting::trace_ray_with_buffers(
 	const Scene &S_scene, const Camera &S_camera, RTCDevice p_device,
-	int32_t i_pixel_x, int32_t i_pixel_y, int32_t i_width, int32_t i_height)
+	int32_t i_pixel_x, int32_t i_pixel_y, int32_t i_width, int32_t i_height,
+	uint64_t u_seed, uint32_t u_sample_index, int32_t i_max_depth)
 {
-	const float f_u =
-		static_cast<float>(i_pixel_x) / static_cast<float>(i_width - 1);
-	const float f_v = static_cast<float>(i_pixel_y) /
-			  static_cast<float>(i_height - 1);
-	const glm::vec3 vec_pixel_position =
-		S_camera.vec_lower_left_corner +
-		S_camera.vec_right * (f_u * S_camera.f_viewport_width) +
-		S_camera.vec_up * (f_v * S_camera.f_viewport_height);
-	const glm::vec3 vec_ray_direction =
-		glm::normalize(vec_pixel_position - S_camera.vec_camera_origin);
+	S_sampler.seed_pixel(u_seed,
+			     static_cast<uint32_t>(i_pixel_y * i_width +
+						   i_pixel_x),
+			     u_sample_index);
+
+	const glm::vec3 vec_ray_direction = camera_ray_direction(
+		S_camera, i_pixel_x, i_pixel_y, i_width, i_height);
 
 	RTCRayHit t_ray_hit;
 	std::memset(&t_ray_hit, 0, sizeof(t_ray_hit));
@@ -314,9 +604,17 @@ SurfaceInfo lighting::trace_ray_with_buffers(
 	rtcInitIntersectContext(&t_context);
 	rtcIntersect1(S_scene.p_RTCscene, &t_context, &t_ray_hit);
 
+	// Camera rays see the light unweighted, whether it is in front of
+	// geometry or of the empty background (tfar is left at FLT_MAX).
+	const bool b_sees_light =
+		i_max_depth > 0 &&
+		intersect_light(S_camera.vec_camera_origin,
+				vec_ray_direction) < t_ray_hit.ray.tfar;
+
 	SurfaceInfo result;
 	if (t_ray_hit.hit.geomID == RTC_INVALID_GEOMETRY_ID) {
-		result.color = glm::vec3(0.0f);
+		result.color =
+			b_sees_light ? light_radiance() : glm::vec3(0.0f);
 		result.albedo = glm::vec3(0.0f);
 		result.normal = glm::vec3(0.0f);
 		return result;
@@ -326,41 +624,39 @@ SurfaceInfo lighting::trace_ray_with_buffers(
 		rtcGetGeometry(S_scene.p_RTCscene, t_ray_hit.hit.geomID);
 	GeometryUserData *p_user_data =
 		(GeometryUserData *)rtcGetGeometryUserData(p_geom);
-	const tinyobj::mesh_t *p_mesh = p_user_data->mesh_ptr;
-
-	int i_mat_id = 0;
-	if (t_ray_hit.hit.primID < p_mesh->material_ids.size()) {
-		i_mat_id = p_mesh->material_ids[t_ray_hit.hit.primID];
-	}
 
 	result.normal = glm::normalize(glm::vec3(
 		t_ray_hit.hit.Ng_x, t_ray_hit.hit.Ng_y, t_ray_hit.hit.Ng_z));
-
-	if (i_mat_id >= 0 &&
-	    i_mat_id < static_cast<int>(S_scene.v_materials.size())) {
-		const tinyobj::material_t &mat = S_scene.v_materials[i_mat_id];
-		result.albedo = glm::vec3(mat.diffuse[0], mat.diffuse[1],
-					  mat.diffuse[2]);
+	const RayCone S_cone = camera_ray_cone(S_camera, i_height);
+	const Material S_material = fetch_textured_material(
+		S_scene, p_user_data->mesh_ptr, t_ray_hit.hit,
+		vec_ray_direction, S_cone.f_spread * t_ray_hit.ray.tfar);
+	result.albedo = S_material.diffuse;
+
+	// The camera ray is shaded from this intersection rather than traced
+	// again.
+	if (b_sees_light) {
+		result.color = light_radiance();
+	} else if (i_max_depth <= 0) {
+		result.color = glm::vec3(0.0f);
 	} else {
-		result.albedo = glm::vec3(1.0f, 0.0f, 1.0f);
+		result.color = shade_hit(S_scene, p_device,
+					 S_camera.vec_camera_origin,
+					 vec_ray_direction, t_ray_hit,
+					 S_material, i_max_depth, S_cone, 0.0f);
 	}
 
-	int max_depth = 3;
-	result.color = trace_ray_recursive(S_scene.p_RTCscene, p_device,
-					   S_camera.vec_camera_origin,
-					   vec_ray_direction, max_depth,
-					   S_scene.v_materials,
-					   S_scene.f_ambient_intensity);
-
 	return result;
 }
 
 glm::vec3 lighting::trace_ray(const Scene &S_scene, const Camera &S_camera,
 			      RTCDevice p_device, int32_t i_pixel_x,
 			      int32_t i_pixel_y, int32_t i_width,
-			      int32_t i_height)
+			      int32_t i_height, uint64_t u_seed,
+			      uint32_t u_sample_index)
 {
 	return trace_ray_with_buffers(S_scene, S_camera, p_device, i_pixel_x,
-				      i_pixel_y, i_width, i_height)
+				      i_pixel_y, i_width, i_height, u_seed,
+				      u_sample_index)
 		.color;
 }
\ No newline at end of file
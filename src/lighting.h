@@ -1,6 +1,7 @@
 #pragma once
 
 #include "common.h"
+#include "sampler.h"
 
 #include <embree3/rtcore.h>
 #include <glm/glm.hpp>
@@ -10,21 +11,111 @@
 
 namespace lighting
 {
+inline constexpr int32_t LIGHT_BOUNCE_DEPTH = 3;
+// Light samples per path vertex, stratified over the light's area.
+inline constexpr int32_t SHADOW_SAMPLES = 4;
+// Glossier surfaces are view dependent and bypass the radiance cache.
+inline constexpr float MAX_CACHED_SPECULAR = 0.1f;
+
+// Footprint of a path modelled as a cone: its width where the current ray
+// starts and its spread angle in radians.
+struct RayCone {
+	float f_width;
+	float f_spread;
+};
+
+struct LightSample {
+	glm::vec3 vec_dir;
+	float f_dist;
+	// Solid angle density of vec_dir.
+	float f_pdf;
+};
+
+glm::vec3 camera_ray_direction(const Camera &S_camera, int32_t i_pixel_x,
+			       int32_t i_pixel_y, int32_t i_width,
+			       int32_t i_height);
+
+// Cone of a camera ray, spreading by one pixel over the focal length.
+RayCone camera_ray_cone(const Camera &S_camera, int32_t i_height);
+
+// Cone of the ray leaving a hit at distance f_hit_t. A sampled bounce widens
+// it by the angular width of the lobes of S_material, weighted by how often
+// each is picked.
+RayCone bounce_ray_cone(const RayCone &S_cone, float f_hit_t,
+			const Material &S_material);
+
+glm::vec3 light_radiance();
+
+// Picks a point in stratum i_stratum of SHADOW_SAMPLES on the area light.
+// Returns false if vec_origin is not in front of the light.
+bool sample_light(const glm::vec3 &vec_origin, int32_t i_stratum,
+		  Sampler &S_rng, LightSample &S_sample);
+
+// Distance along the ray to the emitting side of the area light, or FLT_MAX.
+// The light is not part of the Embree scene.
+float intersect_light(const glm::vec3 &ray_origin,
+		      const glm::vec3 &ray_direction);
+
+// Solid angle density of picking vec_light_dir by uniform area sampling.
+float light_pdf(float f_dist, const glm::vec3 &vec_light_dir);
+
+// Veach's power heuristic for strategy a against b, each taking i_count
+// samples per vertex; light sampling takes SHADOW_SAMPLES to the BSDF's one.
+float power_heuristic(int32_t i_count_a, float f_pdf_a, int32_t i_count_b,
+		      float f_pdf_b);
+
+float specular_probability(const Material &S_material);
+
+// Normalized modified Phong: a Lambert lobe plus a cos^n lobe around the
+// mirror direction of vec_view_dir, which points away from the surface.
+glm::vec3 evaluate_bsdf(const Material &S_material, const glm::vec3 &vec_normal,
+			const glm::vec3 &vec_view_dir,
+			const glm::vec3 &vec_light_dir);
+
+float bsdf_pdf(const Material &S_material, const glm::vec3 &vec_normal,
+	       const glm::vec3 &vec_view_dir, const glm::vec3 &vec_light_dir);
+
+glm::vec3 sample_bsdf_direction(const Material &S_material,
+				const glm::vec3 &vec_normal,
+				const glm::vec3 &vec_view_dir, Sampler &S_rng);
+
 bool is_in_shadow(const RTCScene &p_scene, const glm::vec3 &vec_point,
 		  const glm::vec3 &vec_light_dir, float f_dist_to_light);
 
-glm::vec3 compute_lambert_color(const glm::vec3 &vec_normal,
-				const glm::vec3 &vec_point,
-				const glm::vec3 &vec_material_color,
-				RTCScene p_scene, float f_ambient_strength);
+// Index into the scene's materials, or -1 where fetch_material falls back.
+int32_t material_index(const tinyobj::mesh_t *p_mesh, unsigned int ui_prim_id,
+		       size_t u_num_materials);
+
+Material fetch_material(const std::vector<tinyobj::material_t> &vec_materials,
+			const tinyobj::mesh_t *p_mesh, unsigned int ui_prim_id);
+
+// fetch_material with the scene's textures applied at the hit's UV. The mip
+// level follows from f_cone_width, the ray cone's width at the hit.
+Material fetch_textured_material(const Scene &S_scene,
+				 const tinyobj::mesh_t *p_mesh,
+				 const RTCHit &S_hit,
+				 const glm::vec3 &vec_ray_dir,
+				 float f_cone_width);
+
+// Next-event estimate of the area light's contribution at vec_point. With
+// b_use_mis the samples are weighted against BSDF sampling of the light by
+// the power heuristic.
+glm::vec3 compute_direct_light(const glm::vec3 &vec_normal,
+			       const glm::vec3 &vec_point,
+			       const glm::vec3 &vec_view_dir,
+			       const Material &S_material, RTCScene p_scene,
+			       bool b_use_mis, Sampler &S_rng);
 
 SurfaceInfo trace_ray_with_buffers(const Scene &S_scene, const Camera &S_camera,
 				   RTCDevice p_device, int32_t i_pixel_x,
 				   int32_t i_pixel_y, int32_t i_width,
-				   int32_t i_height);
+				   int32_t i_height, uint64_t u_seed,
+				   uint32_t u_sample_index,
+				   int32_t i_max_depth = LIGHT_BOUNCE_DEPTH);
 
 glm::vec3 trace_ray(const Scene &S_scene, const Camera &S_camera,
 		    RTCDevice p_device, int32_t i_pixel_x, int32_t i_pixel_y,
-		    int32_t i_width, int32_t i_height);
+		    int32_t i_width, int32_t i_height, uint64_t u_seed,
+		    uint32_t u_sample_index);
 
 } // namespace lighting
\ No newline at end of file
@@ -1,8 +1,13 @@
+#include "camera.h"
 #include "common.h"
 #include "renderer.h"
 
 #include <vector>
 #include <string>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
 
 /*
 Notation:
@@ -21,17 +26,215 @@ Notation:
 
 */
 
-int main()
+static void print_usage(const char *psz_program)
 {
-	Renderer::Engine C_renderer{ 1024, 1024, 0.075f };
+	std::cerr << "Usage: " << psz_program
+		  << " [--samples N] [--checkpoint FILE]"
+		     " [--checkpoint-interval SECONDS] [--resume]"
+		     " [--headless] [--camera-path FILE]"
+		     " [--radiance-cache CELL_SIZE]"
+		     " [--radiance-cache-decay F]"
+		     " [--radiance-cache-min-weight W] [--wavefront]"
+		     " [--buckets SIZE] [--output FILE]"
+		     " [--numa] [--numa-replicate]"
+		     " [--texture-memory MB] [--time-budget MS]\n";
+}
+
+static void print_report(const Renderer::RenderReport &S_report)
+{
+	std::cout << "Samples per pixel: "
+		  << S_report.i_full_passes + S_report.f_partial_pass
+		  << " (" << S_report.i_full_passes << " full passes)\n"
+		  << "Pass estimate: " << S_report.f_pass_seconds * 1000.0
+		  << "ms\nRender: " << S_report.f_render_seconds * 1000.0
+		  << "ms, denoise: " << S_report.f_denoise_seconds * 1000.0
+		  << "ms, output: " << S_report.f_output_seconds * 1000.0
+		  << "ms\nTotal: " << S_report.f_total_seconds * 1000.0
+		  << "ms" << (S_report.b_within_budget ? "" : " (over budget)")
+		  << "\n";
+}
+
+// One pose per line: origin x y z, target x y z and an optional fov.
+static std::vector<Camera> load_camera_path(const std::string &s_path)
+{
+	std::vector<Camera> v_poses;
+	std::ifstream t_file(s_path);
+	std::string s_line;
+	while (std::getline(t_file, s_line)) {
+		std::istringstream t_line(s_line);
+		glm::vec3 vec_origin, vec_target;
+		float f_fov = 45.0f;
+		if (!(t_line >> vec_origin.x >> vec_origin.y >> vec_origin.z >>
+		      vec_target.x >> vec_target.y >> vec_target.z)) {
+			continue;
+		}
+		t_line >> f_fov;
+
+		Camera S_pose;
+		camera::look_at(S_pose, vec_origin, vec_target, f_fov);
+		v_poses.push_back(S_pose);
+	}
+	return v_poses;
+}
+
+int main(int argc, char **argv)
+{
+	int32_t i_samples = 16;
+	std::string s_checkpoint_file;
+	double f_checkpoint_interval = 60.0;
+	bool b_resume = false;
+	bool b_headless = false;
+	std::string s_camera_path;
+	bool b_radiance_cache = false;
+	Renderer::RadianceCacheConfig S_cache_config;
+	bool b_wavefront = false;
+	int32_t i_bucket_size = 0;
+	std::string s_output_file;
+	double f_time_budget_ms = 0.0;
+	bool b_numa = false;
+	bool b_numa_replicate = false;
+	Renderer::TextureCacheConfig S_texture_config;
+
+	for (int32_t i = 1; i < argc; i++) {
+		const bool b_has_value = i + 1 < argc;
+		if (!std::strcmp(argv[i], "--samples") && b_has_value) {
+			i_samples = std::stoi(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--checkpoint") &&
+			   b_has_value) {
+			s_checkpoint_file = argv[++i];
+		} else if (!std::strcmp(argv[i], "--checkpoint-interval") &&
+			   b_has_value) {
+			f_checkpoint_interval = std::stod(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--resume")) {
+			b_resume = true;
+		} else if (!std::strcmp(argv[i], "--headless")) {
+			b_headless = true;
+		} else if (!std::strcmp(argv[i], "--camera-path") &&
+			   b_has_value) {
+			s_camera_path = argv[++i];
+		} else if (!std::strcmp(argv[i], "--radiance-cache") &&
+			   b_has_value) {
+			b_radiance_cache = true;
+			S_cache_config.f_cell_size = std::stof(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--radiance-cache-decay") &&
+			   b_has_value) {
+			S_cache_config.f_decay = std::stof(argv[++i]);
+		} else if (!std::strcmp(argv[i],
+					"--radiance-cache-min-weight") &&
+			   b_has_value) {
+			S_cache_config.f_min_weight = std::stof(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--wavefront")) {
+			b_wavefront = true;
+		} else if (!std::strcmp(argv[i], "--numa")) {
+			b_numa = true;
+		} else if (!std::strcmp(argv[i], "--numa-replicate")) {
+			b_numa = true;
+			b_numa_replicate = true;
+		} else if (!std::strcmp(argv[i], "--texture-memory") &&
+			   b_has_value) {
+			S_texture_config.u_memory_limit_mb =
+				std::stoul(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--time-budget") &&
+			   b_has_value) {
+			f_time_budget_ms = std::stod(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--buckets") && b_has_value) {
+			i_bucket_size = std::stoi(argv[++i]);
+		} else if (!std::strcmp(argv[i], "--output") && b_has_value) {
+			s_output_file = argv[++i];
+		} else {
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (i_bucket_size > 0 &&
+	    (!s_checkpoint_file.empty() || !s_camera_path.empty())) {
+		std::cerr << "--buckets cannot be combined with checkpoints"
+			     " or a camera path\n";
+		return EXIT_FAILURE;
+	}
+	if (f_time_budget_ms > 0.0 &&
+	    (i_bucket_size > 0 || !s_checkpoint_file.empty())) {
+		std::cerr << "--time-budget cannot be combined with buckets"
+			     " or checkpoints\n";
+		return EXIT_FAILURE;
+	}
+	// Buckets never hold a full frame to show, and budgeted frames are
+	// for services that only want the file.
+	if (i_bucket_size > 0 || f_time_budget_ms > 0.0) {
+		b_headless = true;
+	}
+
+	if (b_radiance_cache &&
+	    (S_cache_config.f_cell_size <= 0.0f ||
+	     S_cache_config.f_decay <= 0.0f || S_cache_config.f_decay > 1.0f ||
+	     S_cache_config.f_min_weight < 0.0f)) {
+		std::cerr << "--radiance-cache needs a positive cell size,"
+			     " a decay in (0, 1] and a non-negative minimum"
+			     " weight\n";
+		return EXIT_FAILURE;
+	}
+
+	if (b_resume && s_checkpoint_file.empty()) {
+		std::cerr << "--resume needs --checkpoint FILE\n";
+		return EXIT_FAILURE;
+	}
+
+	Renderer::Engine C_renderer{ 1024, 1024, 0.075f, b_headless };
 
 	std::string s_input_file =
 		"/home/gin/Desktop/denoise/src/CornellBox.obj";
 	std::string s_base_dir = "/home/gin/Desktop/denoise/src/";
 
+	C_renderer.configure_texture_cache(S_texture_config);
 	C_renderer.load_obj_scene(s_input_file, s_base_dir);
+	if (b_numa) {
+		C_renderer.enable_numa(b_numa_replicate);
+	}
+
+	C_renderer.use_wavefront_integrator(b_wavefront);
+	if (b_radiance_cache) {
+		C_renderer.enable_radiance_cache(S_cache_config);
+	}
+
+	if (!s_checkpoint_file.empty()) {
+		C_renderer.enable_checkpoints(s_checkpoint_file,
+					      f_checkpoint_interval, b_resume);
+	}
+
+	if (!s_camera_path.empty()) {
+		const std::vector<Camera> v_poses =
+			load_camera_path(s_camera_path);
+		for (size_t i = 0; i < v_poses.size(); i++) {
+			const std::string s_pose_file =
+				"camera_path_" + std::to_string(i) + ".png";
+			C_renderer.set_camera(v_poses[i]);
+			if (f_time_budget_ms > 0.0) {
+				print_report(C_renderer.render_time_budget(
+					f_time_budget_ms, s_pose_file));
+				continue;
+			}
+			C_renderer.render_samples(i_samples);
+			C_renderer.write_color_image(s_pose_file);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (i_bucket_size > 0) {
+		C_renderer.render_buckets(
+			i_samples, i_bucket_size,
+			s_output_file.empty() ? "output.ppm" : s_output_file);
+		return EXIT_SUCCESS;
+	}
+
+	if (f_time_budget_ms > 0.0) {
+		print_report(C_renderer.render_time_budget(
+			f_time_budget_ms,
+			s_output_file.empty() ? "output.png" : s_output_file));
+		return EXIT_SUCCESS;
+	}
 
-	C_renderer.render_loop();
+	C_renderer.render_loop(i_samples);
 
 	return EXIT_SUCCESS;
 }
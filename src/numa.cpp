@@ -0,0 +1,140 @@
+#include "numa.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+static constexpr int32_t MAX_SYSFS_NODES = 1024;
+
+// Binds TBB threads to a node while they work in its arena. Workers go back
+// to the shared pool afterwards, so each gets its previous CPUs back on exit.
+class NodeArenaObserver : public tbb::task_scheduler_observer {
+	const numa::Node &S_node;
+	static thread_local numa::Node S_saved_cpus;
+
+    public:
+	NodeArenaObserver(tbb::task_arena &C_arena, const numa::Node &S_node)
+		: tbb::task_scheduler_observer(C_arena), S_node(S_node)
+	{
+		observe(true);
+	}
+
+	~NodeArenaObserver()
+	{
+		observe(false);
+	}
+
+	void on_scheduler_entry(bool) override
+	{
+		S_saved_cpus = numa::current_thread_cpus();
+		numa::bind_current_thread(S_node);
+	}
+
+	void on_scheduler_exit(bool) override
+	{
+		numa::bind_current_thread(S_saved_cpus);
+	}
+};
+
+thread_local numa::Node NodeArenaObserver::S_saved_cpus;
+
+// Parses a kernel cpulist such as "0-15,32-47".
+static std::vector<int32_t> parse_cpu_list(const std::string &s_list)
+{
+	std::vector<int32_t> v_cpus;
+	std::istringstream t_list(s_list);
+	std::string s_range;
+	while (std::getline(t_list, s_range, ',')) {
+		if (s_range.empty() || s_range == "\n") {
+			continue;
+		}
+		const size_t u_dash = s_range.find('-');
+		const int32_t i_first = std::stoi(s_range.substr(0, u_dash));
+		const int32_t i_last =
+			u_dash == std::string::npos ?
+				i_first :
+				std::stoi(s_range.substr(u_dash + 1));
+		for (int32_t i = i_first; i <= i_last; i++) {
+			v_cpus.push_back(i);
+		}
+	}
+	return v_cpus;
+}
+
+std::vector<numa::Node> numa::discover_nodes()
+{
+	std::vector<Node> v_nodes;
+#ifdef __linux__
+	for (int32_t i = 0; i < MAX_SYSFS_NODES; i++) {
+		std::ifstream t_file("/sys/devices/system/node/node" +
+				     std::to_string(i) + "/cpulist");
+		if (!t_file) {
+			continue;
+		}
+		std::string s_list;
+		std::getline(t_file, s_list);
+		Node S_node{ i, parse_cpu_list(s_list) };
+		// Memory-only nodes have no CPUs to run workers on.
+		if (!S_node.v_cpus.empty()) {
+			v_nodes.push_back(S_node);
+		}
+	}
+#endif
+	if (v_nodes.empty()) {
+		Node S_node{ 0, {} };
+		const int32_t i_cpus = static_cast<int32_t>(
+			std::max(std::thread::hardware_concurrency(), 1u));
+		for (int32_t i = 0; i < i_cpus; i++) {
+			S_node.v_cpus.push_back(i);
+		}
+		v_nodes.push_back(S_node);
+	}
+	return v_nodes;
+}
+
+bool numa::bind_current_thread(const Node &S_node)
+{
+#ifdef __linux__
+	cpu_set_t t_set;
+	CPU_ZERO(&t_set);
+	for (const int32_t i_cpu : S_node.v_cpus) {
+		CPU_SET(i_cpu, &t_set);
+	}
+	return sched_setaffinity(0, sizeof(t_set), &t_set) == 0;
+#else
+	return false;
+#endif
+}
+
+numa::Node numa::current_thread_cpus()
+{
+	Node S_cpus{ -1, {} };
+#ifdef __linux__
+	cpu_set_t t_set;
+	CPU_ZERO(&t_set);
+	if (sched_getaffinity(0, sizeof(t_set), &t_set) == 0) {
+		for (int32_t i = 0; i < CPU_SETSIZE; i++) {
+			if (CPU_ISSET(i, &t_set)) {
+				S_cpus.v_cpus.push_back(i);
+			}
+		}
+	}
+#endif
+	return S_cpus;
+}
+
+void numa::run_on_node(const Node &S_node, const std::function<void()> &work)
+{
+	tbb::task_arena C_arena(static_cast<int32_t>(S_node.v_cpus.size()));
+	NodeArenaObserver C_observer(C_arena, S_node);
+	C_arena.execute(work);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace numa
+{
+struct Node {
+	int32_t i_id;
+	std::vector<int32_t> v_cpus;
+};
+
+// Nodes that have CPUs, read from sysfs. Systems without NUMA information
+// (or other platforms) report a single node holding every CPU.
+std::vector<Node> discover_nodes();
+
+// Restricts the calling thread to the node's CPUs. Returns false where
+// affinity is unsupported or the call fails.
+bool bind_current_thread(const Node &S_node);
+
+// The CPUs the calling thread may run on, as a node with id -1, so that a
+// temporary binding can be undone with bind_current_thread.
+Node current_thread_cpus();
+
+// Runs work in a TBB arena sized to the node, binding every thread that
+// enters it to the node until it leaves. Embree builds BVHs through TBB, so
+// a scene committed in here is built, and its nodes allocated, on the node.
+void run_on_node(const Node &S_node, const std::function<void()> &work);
+
+} // namespace numa
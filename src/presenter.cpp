@@ -0,0 +1,420 @@
+#include "presenter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#define GL_FUNCTIONS(X)                                           \
+	X(PFNGLGENBUFFERSPROC, glGenBuffers)                      \
+	X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers)                \
+	X(PFNGLBINDBUFFERPROC, glBindBuffer)                      \
+	X(PFNGLBUFFERDATAPROC, glBufferData)                      \
+	X(PFNGLMAPBUFFERRANGEPROC, glMapBufferRange)              \
+	X(PFNGLUNMAPBUFFERPROC, glUnmapBuffer)                    \
+	X(PFNGLFENCESYNCPROC, glFenceSync)                        \
+	X(PFNGLCLIENTWAITSYNCPROC, glClientWaitSync)              \
+	X(PFNGLDELETESYNCPROC, glDeleteSync)                      \
+	X(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays)            \
+	X(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays)      \
+	X(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray)            \
+	X(PFNGLCREATESHADERPROC, glCreateShader)                  \
+	X(PFNGLDELETESHADERPROC, glDeleteShader)                  \
+	X(PFNGLSHADERSOURCEPROC, glShaderSource)                  \
+	X(PFNGLCOMPILESHADERPROC, glCompileShader)                \
+	X(PFNGLGETSHADERIVPROC, glGetShaderiv)                    \
+	X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog)          \
+	X(PFNGLCREATEPROGRAMPROC, glCreateProgram)                \
+	X(PFNGLDELETEPROGRAMPROC, glDeleteProgram)                \
+	X(PFNGLATTACHSHADERPROC, glAttachShader)                  \
+	X(PFNGLLINKPROGRAMPROC, glLinkProgram)                    \
+	X(PFNGLGETPROGRAMIVPROC, glGetProgramiv)                  \
+	X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog)        \
+	X(PFNGLUSEPROGRAMPROC, glUseProgram)
+
+#define DECLARE_GL_FUNCTION(type, name) static type p_##name = nullptr;
+GL_FUNCTIONS(DECLARE_GL_FUNCTION)
+#undef DECLARE_GL_FUNCTION
+
+static constexpr int32_t WINDOW_WIDTH = 1024;
+static constexpr int32_t WINDOW_HEIGHT = 1024;
+
+static const char *psz_vertex_shader = R"(#version 330 core
+out vec2 v_uv;
+void main()
+{
+	vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	v_uv = pos;
+	gl_Position = vec4(pos * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+// The frame is linear radiance; this is the ACES curve of tonemap.h.
+static const char *psz_fragment_shader = R"(#version 330 core
+in vec2 v_uv;
+uniform sampler2D u_frame;
+out vec4 o_color;
+void main()
+{
+	vec3 x = texture(u_frame, v_uv).rgb;
+	vec3 mapped = (x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14);
+	o_color = vec4(clamp(mapped, 0.0, 1.0), 1.0);
+}
+)";
+
+static void glfw_error_callback(int32_t i_error, const char *psz_description)
+{
+	std::cerr << "GLFW Error (" << i_error << "): " << psz_description
+		  << "\n";
+}
+
+static bool load_gl_functions()
+{
+	bool b_ok = true;
+#define LOAD_GL_FUNCTION(type, name)                                 \
+	p_##name = reinterpret_cast<type>(glfwGetProcAddress(#name)); \
+	if (!p_##name) {                                             \
+		std::cerr << "Missing GL entry point " #name "\n";   \
+		b_ok = false;                                        \
+	}
+	GL_FUNCTIONS(LOAD_GL_FUNCTION)
+#undef LOAD_GL_FUNCTION
+	return b_ok;
+}
+
+static GLuint compile_shader(GLenum e_type, const char *psz_source)
+{
+	GLuint u_shader = p_glCreateShader(e_type);
+	p_glShaderSource(u_shader, 1, &psz_source, nullptr);
+	p_glCompileShader(u_shader);
+
+	GLint i_status = GL_FALSE;
+	p_glGetShaderiv(u_shader, GL_COMPILE_STATUS, &i_status);
+	if (i_status != GL_TRUE) {
+		char sz_log[1024];
+		p_glGetShaderInfoLog(u_shader, sizeof(sz_log), nullptr, sz_log);
+		std::cerr << "Shader compilation failed: " << sz_log << "\n";
+	}
+	return u_shader;
+}
+
+static GLuint create_quad_program()
+{
+	GLuint u_vertex = compile_shader(GL_VERTEX_SHADER, psz_vertex_shader);
+	GLuint u_fragment =
+		compile_shader(GL_FRAGMENT_SHADER, psz_fragment_shader);
+
+	GLuint u_program = p_glCreateProgram();
+	p_glAttachShader(u_program, u_vertex);
+	p_glAttachShader(u_program, u_fragment);
+	p_glLinkProgram(u_program);
+	p_glDeleteShader(u_vertex);
+	p_glDeleteShader(u_fragment);
+
+	GLint i_status = GL_FALSE;
+	p_glGetProgramiv(u_program, GL_LINK_STATUS, &i_status);
+	if (i_status != GL_TRUE) {
+		char sz_log[1024];
+		p_glGetProgramInfoLog(u_program, sizeof(sz_log), nullptr,
+				      sz_log);
+		std::cerr << "Shader link failed: " << sz_log << "\n";
+	}
+	return u_program;
+}
+
+void Renderer::Presenter::framebuffer_size_callback(GLFWwindow *p_window,
+						    int32_t i_width,
+						    int32_t i_height)
+{
+	Presenter *p_presenter =
+		static_cast<Presenter *>(glfwGetWindowUserPointer(p_window));
+	p_presenter->i_fb_width = i_width;
+	p_presenter->i_fb_height = i_height;
+}
+
+void Renderer::Presenter::mouse_button_callback(GLFWwindow *p_window,
+						int32_t i_button,
+						int32_t i_action,
+						int32_t i_mods)
+{
+	Presenter *p_presenter =
+		static_cast<Presenter *>(glfwGetWindowUserPointer(p_window));
+	if (i_action == GLFW_PRESS) {
+		p_presenter->i_drag_button =
+			(i_mods & GLFW_MOD_SHIFT) ? GLFW_MOUSE_BUTTON_RIGHT :
+						    i_button;
+		glfwGetCursorPos(p_window, &p_presenter->f_cursor_x,
+				 &p_presenter->f_cursor_y);
+	} else if (i_action == GLFW_RELEASE) {
+		p_presenter->i_drag_button = -1;
+	}
+}
+
+void Renderer::Presenter::cursor_pos_callback(GLFWwindow *p_window, double f_x,
+					      double f_y)
+{
+	Presenter *p_presenter =
+		static_cast<Presenter *>(glfwGetWindowUserPointer(p_window));
+	const float f_dx = static_cast<float>(f_x - p_presenter->f_cursor_x);
+	const float f_dy = static_cast<float>(f_y - p_presenter->f_cursor_y);
+	p_presenter->f_cursor_x = f_x;
+	p_presenter->f_cursor_y = f_y;
+
+	CameraInput &S_input = p_presenter->S_camera_input;
+	if (p_presenter->i_drag_button == GLFW_MOUSE_BUTTON_LEFT) {
+		S_input.f_orbit_x += f_dx;
+		S_input.f_orbit_y += f_dy;
+	} else if (p_presenter->i_drag_button == GLFW_MOUSE_BUTTON_RIGHT ||
+		   p_presenter->i_drag_button == GLFW_MOUSE_BUTTON_MIDDLE) {
+		// Cursor positions are in screen coordinates, as is the
+		// window size, whatever the framebuffer's pixel density.
+		int32_t i_window_width, i_window_height;
+		glfwGetWindowSize(p_window, &i_window_width,
+				  &i_window_height);
+		if (i_window_width <= 0 || i_window_height <= 0) {
+			return;
+		}
+		S_input.f_pan_x += f_dx / i_window_width;
+		S_input.f_pan_y += f_dy / i_window_height;
+	} else {
+		return;
+	}
+	p_presenter->b_has_camera_input = true;
+}
+
+void Renderer::Presenter::scroll_callback(GLFWwindow *p_window,
+					  double f_x_offset, double f_y_offset)
+{
+	Presenter *p_presenter =
+		static_cast<Presenter *>(glfwGetWindowUserPointer(p_window));
+	p_presenter->S_camera_input.f_zoom += static_cast<float>(f_y_offset);
+	p_presenter->b_has_camera_input = true;
+}
+
+Renderer::Presenter::Presenter(const int32_t i_width, const int32_t i_height,
+			       const std::string &s_title)
+	: i_width(i_width)
+	, i_height(i_height)
+{
+	glfwSetErrorCallback(glfw_error_callback);
+	if (!glfwInit()) {
+		std::cerr << "Failed to initialize GLFW\n";
+		exit(EXIT_FAILURE);
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GLFW_TRUE);
+
+	p_window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT,
+				    s_title.c_str(), nullptr, nullptr);
+	if (!p_window) {
+		std::cerr << "Failed to create GLFW window\n";
+		glfwTerminate();
+		exit(EXIT_FAILURE);
+	}
+
+	int32_t i_fb_w, i_fb_h;
+	glfwGetFramebufferSize(p_window, &i_fb_w, &i_fb_h);
+	i_fb_width = i_fb_w;
+	i_fb_height = i_fb_h;
+	glfwSetWindowUserPointer(p_window, this);
+	glfwSetFramebufferSizeCallback(p_window, framebuffer_size_callback);
+	glfwSetMouseButtonCallback(p_window, mouse_button_callback);
+	glfwSetCursorPosCallback(p_window, cursor_pos_callback);
+	glfwSetScrollCallback(p_window, scroll_callback);
+
+	for (std::vector<float> &v_snapshot : v_snapshots) {
+		v_snapshot.assign(static_cast<size_t>(i_width) * i_height * 3,
+				  0.0f);
+	}
+}
+
+Renderer::Presenter::~Presenter()
+{
+	stop();
+	glfwDestroyWindow(p_window);
+	glfwTerminate();
+}
+
+void Renderer::Presenter::start()
+{
+	if (b_running.exchange(true)) {
+		return;
+	}
+
+	int32_t i_refresh_rate = 60;
+	const GLFWvidmode *p_mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	if (p_mode && p_mode->refreshRate > 0) {
+		i_refresh_rate = p_mode->refreshRate;
+	}
+	f_frame_period = 1.0 / i_refresh_rate;
+
+	m_present_thread = std::thread(&Presenter::present_loop, this);
+}
+
+void Renderer::Presenter::stop()
+{
+	b_running = false;
+	if (m_present_thread.joinable()) {
+		m_present_thread.join();
+	}
+}
+
+bool Renderer::Presenter::poll_events()
+{
+	glfwPollEvents();
+	return !glfwWindowShouldClose(p_window);
+}
+
+void Renderer::Presenter::wait_events()
+{
+	// Time out so stop signals are still noticed without input.
+	glfwWaitEventsTimeout(0.1);
+}
+
+bool Renderer::Presenter::take_camera_input(CameraInput &S_input)
+{
+	if (!b_has_camera_input) {
+		return false;
+	}
+	S_input = S_camera_input;
+	S_camera_input = CameraInput{};
+	b_has_camera_input = false;
+	return true;
+}
+
+void Renderer::Presenter::publish(const float *p_rgb)
+{
+	std::vector<float> &v_back = v_snapshots[i_back];
+	std::memcpy(v_back.data(), p_rgb, v_back.size() * sizeof(float));
+
+	std::lock_guard<std::mutex> lock(m_swap_mutex);
+	std::swap(i_back, i_pending);
+	b_fresh = true;
+}
+
+bool Renderer::Presenter::take_snapshot()
+{
+	std::lock_guard<std::mutex> lock(m_swap_mutex);
+	if (!b_fresh) {
+		return false;
+	}
+	std::swap(i_front, i_pending);
+	b_fresh = false;
+	return true;
+}
+
+void Renderer::Presenter::present_loop()
+{
+	glfwMakeContextCurrent(p_window);
+	glfwSwapInterval(1);
+	if (!load_gl_functions()) {
+		std::cerr << "OpenGL 3.3 core is required for presentation\n";
+		glfwMakeContextCurrent(nullptr);
+		return;
+	}
+
+	const GLsizeiptr i_snapshot_bytes =
+		static_cast<GLsizeiptr>(i_width) * i_height * 3 *
+		sizeof(float);
+
+	GLuint u_texture;
+	glGenTextures(1, &u_texture);
+	glBindTexture(GL_TEXTURE_2D, u_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, i_width, i_height, 0, GL_RGB,
+		     GL_FLOAT, nullptr);
+
+	// Allocated once. Each is mapped unsynchronized, so a fence from its
+	// last upload guards against overwriting data still being read.
+	GLuint a_pbo[2];
+	GLsync a_upload_fence[2] = { nullptr, nullptr };
+	p_glGenBuffers(2, a_pbo);
+	for (GLuint u_pbo : a_pbo) {
+		p_glBindBuffer(GL_PIXEL_UNPACK_BUFFER, u_pbo);
+		p_glBufferData(GL_PIXEL_UNPACK_BUFFER, i_snapshot_bytes,
+			       nullptr, GL_STREAM_DRAW);
+	}
+	p_glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	GLuint u_vao;
+	p_glGenVertexArrays(1, &u_vao);
+	GLuint u_program = create_quad_program();
+
+	int32_t i_pbo_index = 0;
+	auto next_frame = std::chrono::steady_clock::now();
+	while (b_running) {
+		if (take_snapshot()) {
+			// Fill one PBO while the previous upload may still be
+			// reading from the other one. Its own last upload is
+			// two frames old, so the wait rarely blocks.
+			GLsync &p_fence = a_upload_fence[i_pbo_index];
+			if (p_fence) {
+				p_glClientWaitSync(p_fence,
+						   GL_SYNC_FLUSH_COMMANDS_BIT,
+						   GL_TIMEOUT_IGNORED);
+				p_glDeleteSync(p_fence);
+				p_fence = nullptr;
+			}
+			p_glBindBuffer(GL_PIXEL_UNPACK_BUFFER,
+				       a_pbo[i_pbo_index]);
+			void *p_mapped = p_glMapBufferRange(
+				GL_PIXEL_UNPACK_BUFFER, 0, i_snapshot_bytes,
+				GL_MAP_WRITE_BIT |
+					GL_MAP_INVALIDATE_BUFFER_BIT |
+					GL_MAP_UNSYNCHRONIZED_BIT);
+			if (p_mapped) {
+				std::memcpy(p_mapped,
+					    v_snapshots[i_front].data(),
+					    i_snapshot_bytes);
+				p_glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindTexture(GL_TEXTURE_2D, u_texture);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+						i_width, i_height, GL_RGB,
+						GL_FLOAT, nullptr);
+				p_fence = p_glFenceSync(
+					GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			}
+			p_glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			i_pbo_index ^= 1;
+		}
+
+		glViewport(0, 0, i_fb_width, i_fb_height);
+		glClear(GL_COLOR_BUFFER_BIT);
+		p_glUseProgram(u_program);
+		p_glBindVertexArray(u_vao);
+		glBindTexture(GL_TEXTURE_2D, u_texture);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glfwSwapBuffers(p_window);
+
+		// Swap interval is only a hint; keep to the refresh rate
+		// even when the driver does not block on vsync.
+		next_frame += std::chrono::duration_cast<
+			std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(f_frame_period));
+		const auto now = std::chrono::steady_clock::now();
+		if (next_frame > now) {
+			std::this_thread::sleep_until(next_frame);
+		} else {
+			next_frame = now;
+		}
+	}
+
+	for (GLsync p_fence : a_upload_fence) {
+		if (p_fence) {
+			p_glDeleteSync(p_fence);
+		}
+	}
+	p_glDeleteProgram(u_program);
+	p_glDeleteVertexArrays(1, &u_vao);
+	p_glDeleteBuffers(2, a_pbo);
+	glDeleteTextures(1, &u_texture);
+	glfwMakeContextCurrent(nullptr);
+}
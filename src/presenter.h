@@ -0,0 +1,94 @@
+#pragma once
+
+#define GLFW_INCLUDE_GLEXT
+#include <GLFW/glfw3.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Renderer
+{
+// Mouse motion gathered between two polls. Orbit is in window pixels, pan in
+// fractions of the window so it does not depend on the render resolution, and
+// zoom in scroll steps.
+struct CameraInput {
+	float f_orbit_x = 0.0f;
+	float f_orbit_y = 0.0f;
+	float f_pan_x = 0.0f;
+	float f_pan_y = 0.0f;
+	float f_zoom = 0.0f;
+};
+
+/*
+Owns the window and its GL context. The context lives on a dedicated thread
+that uploads the newest published snapshot through a pixel buffer object and
+draws it with a shader quad at display refresh; the quad's shader applies the
+tonemap. Render threads only copy the linear frame into the back snapshot and
+swap it in under a short lock, so they never wait on GL or vsync.
+*/
+class Presenter {
+	int32_t i_width;
+	int32_t i_height;
+
+	GLFWwindow *p_window;
+	std::thread m_present_thread;
+	std::atomic<bool> b_running{ false };
+	std::atomic<int32_t> i_fb_width;
+	std::atomic<int32_t> i_fb_height;
+	double f_frame_period = 1.0 / 60.0;
+
+	// Snapshot mailbox: the render side owns i_back, the present thread
+	// owns i_front and i_pending is handed over under m_swap_mutex.
+	std::mutex m_swap_mutex;
+	std::array<std::vector<float>, 3> v_snapshots;
+	int32_t i_back = 0;
+	int32_t i_pending = 1;
+	int32_t i_front = 2;
+	bool b_fresh = false;
+
+	// Only touched from the main thread, inside glfwPollEvents.
+	CameraInput S_camera_input;
+	bool b_has_camera_input = false;
+	int32_t i_drag_button = -1;
+	double f_cursor_x = 0.0;
+	double f_cursor_y = 0.0;
+
+    private:
+	static void framebuffer_size_callback(GLFWwindow *p_window,
+					      int32_t i_width,
+					      int32_t i_height);
+	static void mouse_button_callback(GLFWwindow *p_window,
+					  int32_t i_button, int32_t i_action,
+					  int32_t i_mods);
+	static void cursor_pos_callback(GLFWwindow *p_window, double f_x,
+					double f_y);
+	static void scroll_callback(GLFWwindow *p_window, double f_x_offset,
+				    double f_y_offset);
+	void present_loop();
+	bool take_snapshot();
+
+    public:
+	Presenter(const int32_t i_width, const int32_t i_height,
+		  const std::string &s_title);
+	~Presenter();
+
+	Presenter(const Presenter &) = delete;
+	Presenter &operator=(const Presenter &) = delete;
+
+	void start();
+	void stop();
+
+	// Must be called from the main thread. Returns false once the window
+	// has been asked to close.
+	bool poll_events();
+	void wait_events();
+	bool take_camera_input(CameraInput &S_input);
+
+	void publish(const float *p_rgb);
+};
+} // namespace Renderer
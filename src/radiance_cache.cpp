@@ -0,0 +1,141 @@
+#include "radiance_cache.h"
+#include "sampler.h"
+
+#include <omp.h>
+#include <cmath>
+
+static constexpr uint32_t MAX_PROBES = 16;
+static constexpr uint64_t KEY_OCCUPIED = 1ull << 63;
+static constexpr uint64_t CELL_MASK = (1ull << 20) - 1;
+
+Renderer::RadianceCache::RadianceCache(const RadianceCacheConfig &S_config)
+	: S_config(S_config)
+	, f_inv_cell_size(1.0f / S_config.f_cell_size)
+	, u_mask((1ull << S_config.u_capacity_log2) - 1)
+	, p_entries(new Entry[1ull << S_config.u_capacity_log2])
+{
+	for (uint64_t i = 0; i <= u_mask; i++) {
+		for (int32_t c = 0; c < 3; c++) {
+			p_entries[i].a_radiance[c].store(
+				0.0f, std::memory_order_relaxed);
+		}
+	}
+}
+
+uint64_t Renderer::RadianceCache::make_key(const glm::vec3 &vec_point,
+					    const glm::vec3 &vec_normal) const
+{
+	// 20 bits per cell coordinate, 3 bits for the normal's dominant axis
+	// and sign, and a flag so that no key is zero.
+	uint64_t u_key = KEY_OCCUPIED;
+	for (int32_t c = 0; c < 3; c++) {
+		const int64_t i_cell = static_cast<int64_t>(
+			std::floor(vec_point[c] * f_inv_cell_size));
+		u_key |= (static_cast<uint64_t>(i_cell) & CELL_MASK)
+			 << (3 + 20 * c);
+	}
+
+	const glm::vec3 vec_abs(std::abs(vec_normal.x), std::abs(vec_normal.y),
+				std::abs(vec_normal.z));
+	int32_t i_axis = 0;
+	if (vec_abs.y > vec_abs[i_axis]) {
+		i_axis = 1;
+	}
+	if (vec_abs.z > vec_abs[i_axis]) {
+		i_axis = 2;
+	}
+	return u_key | (i_axis * 2 + (vec_normal[i_axis] < 0.0f ? 1 : 0));
+}
+
+Renderer::RadianceCache::Entry *
+Renderer::RadianceCache::find(uint64_t u_key, bool b_insert) const
+{
+	uint64_t u_slot = Sampler::splitmix64(u_key) & u_mask;
+	for (uint32_t i = 0; i < MAX_PROBES; i++) {
+		Entry &S_entry = p_entries[u_slot];
+		uint64_t u_found =
+			S_entry.u_key.load(std::memory_order_acquire);
+		if (u_found == u_key) {
+			return &S_entry;
+		}
+		if (u_found == 0) {
+			if (!b_insert) {
+				return nullptr;
+			}
+			// Another thread may claim the slot first, possibly
+			// for the same cell.
+			if (S_entry.u_key.compare_exchange_strong(
+				    u_found, u_key,
+				    std::memory_order_acq_rel) ||
+			    u_found == u_key) {
+				return &S_entry;
+			}
+		}
+		u_slot = (u_slot + 1) & u_mask;
+	}
+	return nullptr;
+}
+
+bool Renderer::RadianceCache::lookup(const glm::vec3 &vec_point,
+				     const glm::vec3 &vec_normal,
+				     glm::vec3 &vec_radiance) const
+{
+	const Entry *p_entry = find(make_key(vec_point, vec_normal), false);
+	if (!p_entry) {
+		return false;
+	}
+
+	const float f_weight =
+		p_entry->f_weight.load(std::memory_order_relaxed);
+	if (f_weight < S_config.f_min_weight) {
+		return false;
+	}
+	for (int32_t c = 0; c < 3; c++) {
+		vec_radiance[c] =
+			p_entry->a_radiance[c].load(std::memory_order_relaxed) /
+			f_weight;
+	}
+	return true;
+}
+
+void Renderer::RadianceCache::insert(const glm::vec3 &vec_point,
+				     const glm::vec3 &vec_normal,
+				     const glm::vec3 &vec_radiance)
+{
+	Entry *p_entry = find(make_key(vec_point, vec_normal), true);
+	if (!p_entry) {
+		return;
+	}
+
+	// The sums and the weight are updated independently, so a reader can
+	// see one without the other. That is one sample out of at least
+	// f_min_weight, well inside the bias the cache already accepts.
+	for (int32_t c = 0; c < 3; c++) {
+		p_entry->a_radiance[c].fetch_add(vec_radiance[c],
+						 std::memory_order_relaxed);
+	}
+	p_entry->f_weight.fetch_add(1.0f, std::memory_order_relaxed);
+}
+
+void Renderer::RadianceCache::decay()
+{
+	const float f_decay = S_config.f_decay;
+#pragma omp parallel for schedule(static)
+	for (uint64_t i = 0; i <= u_mask; i++) {
+		Entry &S_entry = p_entries[i];
+		if (!S_entry.u_key.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		for (int32_t c = 0; c < 3; c++) {
+			S_entry.a_radiance[c].store(
+				S_entry.a_radiance[c].load(
+					std::memory_order_relaxed) *
+					f_decay,
+				std::memory_order_relaxed);
+		}
+		S_entry.f_weight.store(
+			S_entry.f_weight.load(std::memory_order_relaxed) *
+				f_decay,
+			std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Renderer
+{
+struct RadianceCacheConfig {
+	// Edge length of a grid cell in scene units.
+	float f_cell_size = 8.0f;
+	// Weight a cell needs before lookups return it.
+	float f_min_weight = 16.0f;
+	// Fraction of a cell's weight kept after each pass.
+	float f_decay = 0.9f;
+	uint32_t u_capacity_log2 = 20;
+};
+
+/*
+World-space cache of outgoing radiance at diffuse surfaces, keyed by grid cell
+and the dominant axis of the normal. Render threads insert and look up
+concurrently: slots are claimed with a CAS on the key and the sums are atomic
+adds, so nothing ever locks. The table never deletes keys; a cell whose probe
+window is full simply is not cached.
+
+Cached values depend on the order threads ran in, so a render that uses the
+cache is not reproducible from its seed.
+*/
+class RadianceCache {
+	struct Entry {
+		std::atomic<uint64_t> u_key{ 0 };
+		std::atomic<float> a_radiance[3];
+		std::atomic<float> f_weight{ 0.0f };
+	};
+
+	RadianceCacheConfig S_config;
+	float f_inv_cell_size;
+	uint64_t u_mask;
+	std::unique_ptr<Entry[]> p_entries;
+
+    private:
+	uint64_t make_key(const glm::vec3 &vec_point,
+			  const glm::vec3 &vec_normal) const;
+	Entry *find(uint64_t u_key, bool b_insert) const;
+
+    public:
+	explicit RadianceCache(const RadianceCacheConfig &S_config);
+
+	bool lookup(const glm::vec3 &vec_point, const glm::vec3 &vec_normal,
+		    glm::vec3 &vec_radiance) const;
+	void insert(const glm::vec3 &vec_point, const glm::vec3 &vec_normal,
+		    const glm::vec3 &vec_radiance);
+
+	// Ages every cell by f_decay. Must not run concurrently with render
+	// threads.
+	void decay();
+};
+} // namespace Renderer
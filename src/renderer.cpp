@@ -1,45 +1,91 @@
 #include "renderer.h"
+#include "camera.h"
 #include "lighting.h"
+#include "tonemap.h"
+#include "wavefront.h"
 
 #include <immintrin.h>
+#include <omp.h>
 #include <iostream>
 #include <execution>
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <fstream>
+#include <random>
+#include <thread>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 #include <stb_image.h>
 
-static void glfw_error_callback(int32_t i_error, const char *psz_description)
+static constexpr int32_t TILE_SIZE = 32;
+static constexpr int32_t PREVIEW_BOUNCE_DEPTH = 1;
+static constexpr int32_t a_preview_scales[] = { 8, 4, 2 };
+static constexpr float ORBIT_RADIANS_PER_PIXEL = 0.005f;
+static constexpr float ZOOM_PER_STEP = 0.9f;
+// Pixels the denoiser sees around each bucket so it works across its seams.
+static constexpr int32_t BUCKET_OVERLAP = 32;
+// Weight of the newest measurement in the time-budget cost estimates.
+static constexpr double COST_EMA_WEIGHT = 0.5;
+// Starting guesses until a first denoise and write have been timed.
+static constexpr double DEFAULT_DENOISE_SECONDS_PER_PIXEL = 5e-7;
+static constexpr double DEFAULT_OUTPUT_SECONDS_PER_PIXEL = 2e-7;
+// Headroom on the time held back for denoising and output.
+static constexpr double RESERVE_MARGIN = 1.25;
+
+static std::atomic<bool> b_stop_requested{ false };
+
+static double now_seconds()
 {
-	std::cerr << "GLFW Error (" << i_error << "): " << psz_description
-		  << "\n";
+	return std::chrono::duration<double>(
+		       std::chrono::steady_clock::now().time_since_epoch())
+		.count();
 }
 
-static void embree_error_func(void *, RTCError i_error, const char *psz_str)
+static double blend_estimate(const double f_estimate, const double f_measured)
 {
-	std::cerr << "Embree error (" << i_error << "): " << psz_str << "\n";
+	return f_estimate + (f_measured - f_estimate) * COST_EMA_WEIGHT;
 }
 
-void Renderer::Engine::init_glfw()
+// Step for walking i_count tiles so any prefix of the walk is scattered over
+// the frame: a stride near the golden ratio of the count, made coprime to it
+// so k * stride % i_count visits every tile exactly once.
+static int32_t tile_stride(const int32_t i_count)
 {
-	glfwSetErrorCallback(glfw_error_callback);
-	if (!glfwInit()) {
-		std::cerr << "Failed to initialize GLFW\n";
-		exit(EXIT_FAILURE);
+	int32_t i_stride = std::max(static_cast<int32_t>(i_count * 0.618), 1);
+	while (std::gcd(i_stride, i_count) != 1) {
+		i_stride++;
 	}
+	return i_stride;
+}
 
-	p_window = glfwCreateWindow(1024, 1024,
-				    "Cornell Box - Flat Light + Lambert",
-				    nullptr, nullptr);
-	if (!p_window) {
-		std::cerr << "Failed to create GLFW window\n";
-		glfwTerminate();
-		exit(EXIT_FAILURE);
-	}
+static int32_t strided_tile(const int32_t k, const int32_t i_stride,
+			    const int32_t i_count)
+{
+	return static_cast<int32_t>(static_cast<int64_t>(k) * i_stride %
+				    i_count);
+}
+
+static void embree_error_func(void *, RTCError i_error, const char *psz_str)
+{
+	std::cerr << "Embree error (" << i_error << "): " << psz_str << "\n";
+}
 
-	glfwMakeContextCurrent(p_window);
-	glfwSwapInterval(1);
+static void stop_signal_handler(int32_t i_signal)
+{
+	b_stop_requested = true;
+}
+
+void Renderer::Engine::init_presenter()
+{
+	p_presenter = std::make_unique<Presenter>(
+		i_width, i_height, "Cornell Box - Flat Light + Lambert");
+	p_presenter->start();
 }
 
 void Renderer::Engine::init_embree_device()
@@ -54,59 +100,49 @@ void Renderer::Engine::init_embree_device()
 
 void Renderer::Engine::init_camera()
 {
-	S_camera.vec_scene_center = { -278.0f, 274.4f, -279.6f };
-	S_camera.vec_camera_origin = { S_camera.vec_scene_center.x,
-				       S_camera.vec_scene_center.y, 800.0f };
-	S_camera.vec_view_dir = glm::normalize(S_camera.vec_scene_center -
-					       S_camera.vec_camera_origin);
-	S_camera.vec_up = { 0.0f, 1.0f, 0.0f };
-	S_camera.vec_right = glm::normalize(
-		glm::cross(S_camera.vec_view_dir, S_camera.vec_up));
-
-	S_camera.f_fov = 45.0f;
-	S_camera.f_focal_length = glm::length(S_camera.vec_scene_center -
-					      S_camera.vec_camera_origin);
-	S_camera.f_viewport_height = 2.0f * S_camera.f_focal_length *
-				     tan(glm::radians(S_camera.f_fov) / 2.0f);
-	S_camera.f_viewport_width = S_camera.f_viewport_height;
-
-	S_camera.vec_lower_left_corner =
-		S_camera.vec_camera_origin +
-		S_camera.vec_view_dir * S_camera.f_focal_length -
-		S_camera.vec_right * (S_camera.f_viewport_width * 0.5f) -
-		S_camera.vec_up * (S_camera.f_viewport_height * 0.5f);
+	const glm::vec3 vec_scene_center{ -278.0f, 274.4f, -279.6f };
+	const glm::vec3 vec_camera_origin{ vec_scene_center.x,
+					   vec_scene_center.y, 800.0f };
+	camera::look_at(S_camera, vec_camera_origin, vec_scene_center, 45.0f);
+	S_pending_camera = S_camera;
 }
 
 Renderer::Engine::Engine(const int32_t i_width, const int32_t i_height,
-			 const float f_ambient_intensity)
+			 const float f_ambient_intensity, const bool b_headless)
 	: i_width(i_width)
 	, i_height(i_height)
 	, m_oidn_device(oidn::newDevice())
-	, v_color_buffer(i_width * i_height * 3, 0.0f)
-	, v_albedo_buffer(i_width * i_height * 3, 0.0f)
-	, v_normal_buffer(i_width * i_height * 3, 0.0f)
-	, m_denoised_frame(i_width * i_height * 3, 0.0f)
+	, C_film(0, 0)
+	, u_seed((static_cast<uint64_t>(std::random_device{}()) << 32) |
+		 std::random_device{}())
+	, f_denoise_seconds_per_pixel(DEFAULT_DENOISE_SECONDS_PER_PIXEL)
+	, f_output_seconds_per_pixel(DEFAULT_OUTPUT_SECONDS_PER_PIXEL)
 {
-	init_glfw();
+	if (!b_headless) {
+		init_presenter();
+	}
 	init_embree_device();
 	init_camera();
 	S_scene.f_ambient_intensity = f_ambient_intensity;
 
 	m_oidn_device.commit();
 	m_denoiser_filter = m_oidn_device.newFilter("RT");
+	// The film accumulates linear radiance.
+	m_denoiser_filter.set("hdr", true);
 }
 
 Renderer::Engine::~Engine()
 {
+	for (Scene &S_replica : v_node_scenes) {
+		rtcReleaseScene(S_replica.p_RTCscene);
+	}
 	rtcReleaseScene(S_scene.p_RTCscene);
 	rtcReleaseDevice(p_RTCdevice);
 
 	m_denoiser_filter.release();
 	m_oidn_device.release();
 
-	glDeleteTextures(1, &m_texture_id);
-	glfwDestroyWindow(p_window);
-	glfwTerminate();
+	p_presenter.reset();
 }
 
 void Renderer::Engine::load_obj_scene(const std::string &s_obj_file,
@@ -120,11 +156,57 @@ void Renderer::Engine::load_obj_scene(const std::string &s_obj_file,
 		exit(EXIT_FAILURE);
 	}
 
-	S_scene.p_RTCscene = rtcNewScene(p_RTCdevice);
+	load_textures(s_base_dir);
+	S_scene.p_RTCscene = build_rtc_scene(S_scene);
+}
+
+void Renderer::Engine::configure_texture_cache(
+	const TextureCacheConfig &S_config)
+{
+	S_texture_config = S_config;
+}
+
+void Renderer::Engine::load_textures(const std::string &s_base_dir)
+{
+	const auto has_textures = [](const tinyobj::material_t &S_material) {
+		return !S_material.diffuse_texname.empty() ||
+		       !S_material.specular_texname.empty() ||
+		       !S_material.emissive_texname.empty();
+	};
+	if (std::none_of(S_scene.v_materials.begin(),
+			 S_scene.v_materials.end(), has_textures)) {
+		return;
+	}
+
+	p_texture_cache = std::make_unique<TextureCache>(S_texture_config);
+	const auto load = [&](const std::string &s_name) {
+		if (s_name.empty()) {
+			return -1;
+		}
+		return p_texture_cache->load(s_base_dir + s_name);
+	};
+	for (const tinyobj::material_t &S_material : S_scene.v_materials) {
+		S_scene.v_material_textures.push_back(
+			{ load(S_material.diffuse_texname),
+			  load(S_material.specular_texname),
+			  load(S_material.emissive_texname) });
+	}
+	S_scene.p_texture_cache = p_texture_cache.get();
+
+	std::cout << "Loaded " << p_texture_cache->texture_count()
+		  << " textures, "
+		  << p_texture_cache->backing_bytes() / (1024 * 1024)
+		  << " MB tiled, " << S_texture_config.u_memory_limit_mb
+		  << " MB resident at most\n";
+}
+
+RTCScene Renderer::Engine::build_rtc_scene(Scene &S_target)
+{
+	RTCScene p_rtc_scene = rtcNewScene(p_RTCdevice);
 
-	for (size_t s = 0; s < S_scene.v_shapes.size(); s++) {
-		const tinyobj::mesh_t &S_mesh = S_scene.v_shapes[s].mesh;
-		size_t i_num_vertices = S_scene.S_attrib.vertices.size() / 3;
+	for (size_t s = 0; s < S_target.v_shapes.size(); s++) {
+		const tinyobj::mesh_t &S_mesh = S_target.v_shapes[s].mesh;
+		size_t i_num_vertices = S_target.S_attrib.vertices.size() / 3;
 		size_t i_num_triangles = S_mesh.indices.size() / 3;
 
 		RTCGeometry p_geom =
@@ -135,9 +217,9 @@ void Renderer::Engine::load_obj_scene(const std::string &s_obj_file,
 			sizeof(Vertex), i_num_vertices);
 
 		for (size_t i = 0; i < i_num_vertices; i++) {
-			p_vertices[i].x = S_scene.S_attrib.vertices[3 * i + 0];
-			p_vertices[i].y = S_scene.S_attrib.vertices[3 * i + 1];
-			p_vertices[i].z = S_scene.S_attrib.vertices[3 * i + 2];
+			p_vertices[i].x = S_target.S_attrib.vertices[3 * i + 0];
+			p_vertices[i].y = S_target.S_attrib.vertices[3 * i + 1];
+			p_vertices[i].z = S_target.S_attrib.vertices[3 * i + 2];
 		}
 
 		Triangle *p_triangles = (Triangle *)rtcSetNewGeometryBuffer(
@@ -158,239 +240,971 @@ void Renderer::Engine::load_obj_scene(const std::string &s_obj_file,
 		rtcSetGeometryUserData(p_geom, p_user_data);
 
 		rtcCommitGeometry(p_geom);
-		rtcAttachGeometryByID(S_scene.p_RTCscene, p_geom,
+		rtcAttachGeometryByID(p_rtc_scene, p_geom,
 				      static_cast<unsigned>(s));
 		rtcReleaseGeometry(p_geom);
 	}
 
-	rtcCommitScene(S_scene.p_RTCscene);
+	rtcCommitScene(p_rtc_scene);
+	return p_rtc_scene;
 }
 
-void Renderer::Engine::render_loop(const int sample_limit)
+void Renderer::Engine::enable_checkpoints(const std::string &s_path,
+					 const double f_interval_seconds,
+					 const bool b_resume)
 {
-	int sample_count = 0;
+	allocate_film();
+	f_checkpoint_interval = f_interval_seconds;
+	p_checkpoint = std::make_unique<Checkpoint>(s_path, i_width, i_height);
 
-	GLuint texture_id;
-	std::vector<float> v_framebuffer(i_width * i_height * 3, 0.0f);
+	std::signal(SIGTERM, stop_signal_handler);
+	std::signal(SIGINT, stop_signal_handler);
 
-	glGenTextures(1, &texture_id);
-	glBindTexture(GL_TEXTURE_2D, texture_id);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// The radiance cache is not part of the checkpoint. A resumed render
+	// starts with it empty, so it is not sample for sample the render an
+	// uninterrupted run would have produced.
+	if (b_resume && p_radiance_cache) {
+		std::cout << "Note: the radiance cache is not checkpointed and "
+			     "restarts empty\n";
+	}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, i_width, i_height, 0, GL_RGB,
-		     GL_FLOAT, nullptr);
+	// Creating the file truncates it, so under --resume an existing file
+	// that cannot be resumed is an error rather than a fresh start; it
+	// may hold hours of samples from another build or resolution.
+	if (b_resume && p_checkpoint->file_exists()) {
+		CheckpointState S_state;
+		if (!p_checkpoint->open_existing()) {
+			std::cerr << "Refusing to overwrite " << s_path
+				  << "; move it away or drop --resume\n";
+			exit(EXIT_FAILURE);
+		}
+		if (!p_checkpoint->restore(S_state, C_film)) {
+			std::cerr << "Checkpoint " << s_path
+				  << " holds no complete snapshot\n"
+				  << "Refusing to overwrite " << s_path
+				  << "; move it away or drop --resume\n";
+			exit(EXIT_FAILURE);
+		}
+		u_seed = S_state.u_seed;
+		i_sample_count = S_state.i_sample_count;
+		S_camera = S_state.S_camera;
+		S_pending_camera = S_camera;
+		std::cout << "Resuming from checkpoint " << s_path
+			  << " at sample " << i_sample_count << "\n";
+		return;
+	}
 
-	m_texture_id = texture_id;
-	std::fill(std::execution::par_unseq, v_framebuffer.begin(),
-		  v_framebuffer.end(), 0.0f);
+	if (b_resume) {
+		std::cout << "No checkpoint at " << s_path
+			  << ", starting a new render\n";
+	}
+	if (!p_checkpoint->create()) {
+		p_checkpoint.reset();
+	}
+}
 
-	double last_time = glfwGetTime();
-	while (true) {
-		glfwPollEvents();
-		if (glfwWindowShouldClose(p_window)) {
-			exit(EXIT_FAILURE);
+void Renderer::Engine::save_checkpoint()
+{
+	if (!p_checkpoint) {
+		return;
+	}
+
+	const CheckpointState S_state{ i_width, i_height, u_seed,
+				       i_sample_count, S_camera };
+	p_checkpoint->save(S_state, C_film);
+}
+
+void Renderer::Engine::enable_radiance_cache(
+	const RadianceCacheConfig &S_config)
+{
+	p_radiance_cache = std::make_unique<RadianceCache>(S_config);
+	S_scene.p_radiance_cache = p_radiance_cache.get();
+	for (Scene &S_replica : v_node_scenes) {
+		S_replica.p_radiance_cache = p_radiance_cache.get();
+	}
+}
+
+void Renderer::Engine::enable_numa(const bool b_replicate_scene)
+{
+	std::vector<numa::Node> v_nodes = numa::discover_nodes();
+	if (v_nodes.size() < 2) {
+		std::cout << "Single NUMA node, thread placement disabled\n";
+		return;
+	}
+	v_numa_nodes = std::move(v_nodes);
+	const int32_t i_num_nodes = static_cast<int32_t>(v_numa_nodes.size());
+
+	// One worker per CPU, numbered node by node.
+	v_thread_node.clear();
+	v_thread_rank.clear();
+	for (int32_t n = 0; n < i_num_nodes; n++) {
+		for (size_t i = 0; i < v_numa_nodes[n].v_cpus.size(); i++) {
+			v_thread_node.push_back(n);
+			v_thread_rank.push_back(static_cast<int32_t>(i));
 		}
+	}
+	omp_set_dynamic(0);
+	omp_set_num_threads(static_cast<int32_t>(v_thread_node.size()));
 
-		if (sample_count >= sample_limit)
-			break;
-		render_frame(v_framebuffer);
-
-		sample_count++;
-		for (int i = 0; i < i_width * i_height * 3; i++) {
-			v_color_buffer[i] =
-				(v_color_buffer[i] * (sample_count - 1) +
-				 v_framebuffer[i]) /
-				sample_count;
-		}
-
-		glBindTexture(GL_TEXTURE_2D, m_texture_id);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, i_width, i_height,
-				GL_RGB, GL_FLOAT, v_color_buffer.data());
-
-		glClear(GL_COLOR_BUFFER_BIT);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, m_texture_id);
-		glBegin(GL_QUADS);
-		{
-			glTexCoord2f(0.0f, 0.0f);
-			glVertex2f(-1.0f, -1.0f);
-
-			glTexCoord2f(1.0f, 0.0f);
-			glVertex2f(1.0f, -1.0f);
-
-			glTexCoord2f(1.0f, 1.0f);
-			glVertex2f(1.0f, 1.0f);
-
-			glTexCoord2f(0.0f, 1.0f);
-			glVertex2f(-1.0f, 1.0f);
-		}
-		glEnd();
-		glDisable(GL_TEXTURE_2D);
-		glfwSwapBuffers(p_window);
-		std::cout << "Sample count: " << sample_count << "\n";
-	}
-	double current_time = glfwGetTime();
-	std::cout << "Frame time: " << current_time - last_time
-		  << "s\nSample count: " << sample_count << "\nSample Time: "
-		  << (current_time - last_time) / sample_count << "s\n";
-
-	Renderer::Engine::write_buffer_to_image(v_color_buffer, i_width,
-						i_height, "color_buffer.png");
-	Renderer::Engine::write_buffer_to_image(v_albedo_buffer, i_width,
-						i_height, "albedo_buffer.png");
-	Renderer::Engine::write_buffer_to_image(v_normal_buffer, i_width,
-						i_height, "normal_buffer.png");
-	oidn_denoise();
+	// The OpenMP pool keeps its threads between regions, so binding them
+	// once is enough. The main thread stays unbound, as the GL, OIDN and
+	// TBB threads it spawns would inherit its mask; it is bound only for
+	// the regions that place memory or claim tiles.
+#pragma omp parallel
+	{
+		const int32_t i_thread = omp_get_thread_num();
+		if (i_thread != 0) {
+			numa::bind_current_thread(
+				v_numa_nodes[v_thread_node[i_thread]]);
+		}
+	}
 
-	while (true) {
-		glfwPollEvents();
-		if (glfwWindowShouldClose(p_window)) {
-			exit(EXIT_FAILURE);
+	v_node_samples = std::vector<std::atomic<uint64_t>>(i_num_nodes);
+	v_node_stolen_tiles = std::vector<std::atomic<uint64_t>>(i_num_nodes);
+
+	if (b_replicate_scene && S_scene.p_RTCscene) {
+		// Each copy is made by a thread bound to its node, so the
+		// tinyobj data and the Embree geometry buffers are node-local,
+		// and committed in an arena whose TBB threads are bound to the
+		// node, so the BVH is built there too.
+		v_node_scenes.resize(i_num_nodes);
+		std::vector<std::thread> v_builders;
+		for (int32_t n = 0; n < i_num_nodes; n++) {
+			v_builders.emplace_back([this, n]() {
+				numa::bind_current_thread(v_numa_nodes[n]);
+				v_node_scenes[n] = S_scene;
+				numa::run_on_node(v_numa_nodes[n], [this, n]() {
+					v_node_scenes[n].p_RTCscene =
+						build_rtc_scene(
+							v_node_scenes[n]);
+				});
+			});
+		}
+		for (std::thread &t_builder : v_builders) {
+			t_builder.join();
 		}
+	}
+
+	std::cout << "NUMA placement across " << i_num_nodes << " nodes, "
+		  << v_thread_node.size() << " threads"
+		  << (v_node_scenes.empty() ? "" : ", scene replicated")
+		  << "\n";
+}
 
-		glBindTexture(GL_TEXTURE_2D, m_texture_id);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, i_width, i_height,
-				GL_RGB, GL_FLOAT, m_denoised_frame.data());
+void Renderer::Engine::use_wavefront_integrator(const bool b_enable)
+{
+	b_wavefront = b_enable;
+}
+
+void Renderer::Engine::set_seed(const uint64_t u_new_seed)
+{
+	u_seed = u_new_seed;
+}
 
-		glClear(GL_COLOR_BUFFER_BIT);
-		glEnable(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, m_texture_id);
-		glBegin(GL_QUADS);
-		{
-			glTexCoord2f(0.0f, 0.0f);
-			glVertex2f(-1.0f, -1.0f);
+void Renderer::Engine::set_camera(const Camera &S_new_camera)
+{
+	S_pending_camera = S_new_camera;
+	b_camera_dirty = true;
+}
 
-			glTexCoord2f(1.0f, 0.0f);
-			glVertex2f(1.0f, -1.0f);
+const Camera &Renderer::Engine::get_camera() const
+{
+	return S_camera;
+}
 
-			glTexCoord2f(1.0f, 1.0f);
-			glVertex2f(1.0f, 1.0f);
+bool Renderer::Engine::poll_input()
+{
+	if (p_presenter) {
+		if (!p_presenter->poll_events()) {
+			b_window_closed = true;
+		}
 
-			glTexCoord2f(0.0f, 1.0f);
-			glVertex2f(-1.0f, 1.0f);
+		CameraInput S_input;
+		if (p_presenter->take_camera_input(S_input)) {
+			camera::orbit(S_pending_camera,
+				      -S_input.f_orbit_x *
+					      ORBIT_RADIANS_PER_PIXEL,
+				      S_input.f_orbit_y *
+					      ORBIT_RADIANS_PER_PIXEL);
+			camera::pan(S_pending_camera, -S_input.f_pan_x,
+				    S_input.f_pan_y);
+			camera::zoom(S_pending_camera,
+				     std::pow(ZOOM_PER_STEP, S_input.f_zoom));
+			b_camera_dirty = true;
 		}
-		glEnd();
-		glDisable(GL_TEXTURE_2D);
-		glfwSwapBuffers(p_window);
 	}
+	return b_camera_dirty || b_window_closed || b_stop_requested;
 }
 
-static inline float ACES_tonemapper(const float x)
+void Renderer::Engine::restart_accumulation()
 {
-	static constexpr float a = 2.51f;
-	static constexpr float b = 0.03f;
-	static constexpr float c = 2.43f;
-	static constexpr float d = 0.59f;
-	static constexpr float e = 0.14f;
-	return glm::clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0f,
-			  1.0f);
+	S_camera = S_pending_camera;
+	b_camera_dirty = false;
+	i_sample_count = 0;
+
+	// The previous snapshot belongs to the old view.
+	if (p_checkpoint) {
+		p_checkpoint->reset();
+	}
+
+	const double f_restart_time = now_seconds();
+	for (const int32_t i_scale : a_preview_scales) {
+		if (!render_frame(i_scale)) {
+			return;
+		}
+		if (p_presenter) {
+			p_presenter->publish(C_film.v_color.data());
+		}
+		if (i_scale == a_preview_scales[0]) {
+			std::cout << "Preview latency: "
+				  << (now_seconds() - f_restart_time) * 1000.0
+				  << "ms\n";
+		}
+	}
 }
 
-void Renderer::Engine::oidn_denoise()
+void Renderer::Engine::finish_pass()
 {
-	std::fill(std::execution::par_unseq, m_denoised_frame.begin(),
-		  m_denoised_frame.end(), 0.0f);
+	i_sample_count++;
+	if (p_radiance_cache) {
+		p_radiance_cache->decay();
+	}
+}
 
-	double last_time = glfwGetTime();
+void Renderer::Engine::render_pass()
+{
+	allocate_film();
+	if (render_frame(1)) {
+		finish_pass();
+	}
+}
 
-	m_denoiser_filter.setImage("color", v_color_buffer.data(),
-				   oidn::Format::Float3, i_width, i_height);
-	m_denoiser_filter.setImage("albedo", v_albedo_buffer.data(),
-				   oidn::Format::Float3, i_width, i_height);
-	m_denoiser_filter.setImage("normal", v_normal_buffer.data(),
+void Renderer::Engine::render_samples(const int sample_limit)
+{
+	allocate_film();
+	double last_checkpoint_time = now_seconds();
+	while (true) {
+		if (poll_input() && !b_camera_dirty) {
+			return;
+		}
+		if (b_camera_dirty) {
+			restart_accumulation();
+			continue;
+		}
+
+		if (i_sample_count >= sample_limit)
+			return;
+		if (!render_frame(1)) {
+			continue;
+		}
+		finish_pass();
+
+		if (p_presenter) {
+			p_presenter->publish(C_film.v_color.data());
+		}
+		std::cout << "Sample count: " << i_sample_count << "\n";
+
+		const double now = now_seconds();
+		if (p_checkpoint &&
+		    now - last_checkpoint_time >= f_checkpoint_interval) {
+			save_checkpoint();
+			last_checkpoint_time = now;
+		}
+	}
+}
+
+void Renderer::Engine::write_color_image(const std::string &s_output_file)
+{
+	Renderer::Engine::write_buffer_to_image(C_film.v_color.data(), i_width,
+						i_height, s_output_file, true);
+}
+
+void Renderer::Engine::render_loop(const int sample_limit)
+{
+	while (true) {
+		const int i_start_count = i_sample_count;
+		double last_time = now_seconds();
+
+		render_samples(sample_limit);
+
+		if (b_window_closed) {
+			p_presenter->stop();
+			exit(EXIT_FAILURE);
+		}
+		if (b_stop_requested) {
+			save_checkpoint();
+			std::cout << "Stopped at sample " << i_sample_count
+				  << "\n";
+			if (p_presenter) {
+				p_presenter->stop();
+			}
+			exit(EXIT_FAILURE);
+		}
+		save_checkpoint();
+
+		const int i_rendered =
+			std::max(i_sample_count - i_start_count, 1);
+		double current_time = now_seconds();
+		std::cout << "Frame time: " << current_time - last_time
+			  << "s\nSample count: " << i_sample_count
+			  << "\nSample Time: "
+			  << (current_time - last_time) / i_rendered << "s\n";
+		report_node_throughput(current_time - last_time);
+		if (p_texture_cache) {
+			std::cout << "Texture tiles paged in: "
+				  << p_texture_cache->tile_reads() << "\n";
+		}
+
+		Renderer::Engine::write_buffer_to_image(
+			C_film.v_color.data(), i_width, i_height,
+			"color_buffer.png", true);
+		Renderer::Engine::write_buffer_to_image(
+			C_film.albedo_to_float().data(), i_width, i_height,
+			"albedo_buffer.png");
+		Renderer::Engine::write_buffer_to_image(
+			C_film.normal_to_float().data(), i_width, i_height,
+			"normal_buffer.png");
+		oidn_denoise();
+
+		if (!p_presenter) {
+			return;
+		}
+
+		// Show the result until the window closes or the camera moves.
+		p_presenter->publish(C_film.v_denoised.data());
+		while (!poll_input()) {
+			p_presenter->wait_events();
+		}
+		if (b_window_closed) {
+			return;
+		}
+	}
+}
+
+void Renderer::Engine::oidn_denoise(const bool b_write_image)
+{
+	double last_time = now_seconds();
+
+	m_denoiser_filter.setImage("color", C_film.v_color.data(),
 				   oidn::Format::Float3, i_width, i_height);
-	m_denoiser_filter.setImage("output", m_denoised_frame.data(),
+	m_denoiser_filter.setImage("albedo", C_film.v_albedo.data(),
+				   oidn::Format::Half3, i_width, i_height);
+	m_denoiser_filter.setImage("normal", C_film.v_normal.data(),
+				   oidn::Format::Half3, i_width, i_height);
+	m_denoiser_filter.setImage("output", C_film.v_denoised.data(),
 				   oidn::Format::Float3, i_width, i_height);
 	m_denoiser_filter.commit();
 	m_denoiser_filter.execute();
 
-	double current_time = glfwGetTime();
+	double current_time = now_seconds();
 	std::cout << "Denoising time: " << current_time - last_time << "s\n";
-	Renderer::Engine::write_buffer_to_image(m_denoised_frame, i_width,
-						i_height,
-						"./oidn_denoised_frame.png");
+	if (b_write_image) {
+		Renderer::Engine::write_buffer_to_image(
+			C_film.v_denoised.data(), i_width, i_height,
+			"./oidn_denoised_frame.png", true);
+	}
 }
 
-void Renderer::Engine::custom_denoise()
+void Renderer::Engine::custom_denoise(const bool b_write_image)
 {
-	std::fill(std::execution::par_unseq, m_denoised_frame.begin(),
-		  m_denoised_frame.end(), 0.0f);
-	double last_time = glfwGetTime();
+	std::fill(std::execution::par_unseq, C_film.v_denoised.begin(),
+		  C_film.v_denoised.end(), 0.0f);
+	double last_time = now_seconds();
 
-	double current_time = glfwGetTime();
+	double current_time = now_seconds();
 	std::cout << "Denoising time: " << current_time - last_time << "s\n";
-	Renderer::Engine::write_buffer_to_image(m_denoised_frame, i_width,
-						i_height,
-						"./custom_denoised_frame.png");
-}
-
-void Renderer::Engine::render_frame(std::vector<float> &v_framebuffer)
-{
-	// static std::vector<int32_t> v_pixel_y;
-	// if (v_pixel_y.empty()) {
-	// 	v_pixel_y.resize(i_height);
-	// 	std::iota(v_pixel_y.begin(), v_pixel_y.end(), 0);
-	// }
-
-	// std::for_each(
-	// 	std::execution::par, v_pixel_y.begin(), v_pixel_y.end(),
-	// 	[&](int32_t i_pixel_y) {
-	// 		for (int i_pixel_x = 0; i_pixel_x < i_width;
-	// 		     i_pixel_x++) {
-	// 			const glm::vec3 vec_color{ lighting::trace_ray(
-	// 				S_scene, S_camera, p_RTCdevice,
-	// 				i_pixel_x, i_pixel_y, i_width,
-	// 				i_height) };
-
-	// 			int i_index =
-	// 				(i_pixel_y * i_width + i_pixel_x) * 3;
-	// 			v_framebuffer[i_index + 0] = vec_color.r;
-	// 			v_framebuffer[i_index + 1] = vec_color.g;
-	// 			v_framebuffer[i_index + 2] = vec_color.b;
-	// 		}
-	// 	});
+	if (b_write_image) {
+		Renderer::Engine::write_buffer_to_image(
+			C_film.v_denoised.data(), i_width, i_height,
+			"./custom_denoised_frame.png", true);
+	}
+}
+
+int32_t Renderer::Engine::get_sample_count() const
+{
+	return i_sample_count;
+}
+
+const Renderer::Film &Renderer::Engine::get_film() const
+{
+	return C_film;
+}
+
+bool Renderer::Engine::render_frame(const int32_t i_scale)
+{
+	const int32_t i_tiles_x = (i_width + TILE_SIZE - 1) / TILE_SIZE;
+	const int32_t i_tiles_y = (i_height + TILE_SIZE - 1) / TILE_SIZE;
+	const int32_t i_num_tiles = i_tiles_x * i_tiles_y;
+	const int32_t i_max_depth = i_scale > 1 ?
+					    PREVIEW_BOUNCE_DEPTH :
+					    lighting::LIGHT_BOUNCE_DEPTH;
+	std::atomic<bool> b_cancelled{ false };
+
+	// The main thread owns the window, so it checks for input between its
+	// tiles and the other threads drop what is left. A stop request lets
+	// the pass finish so the accumulation stays consistent for the
+	// checkpoint.
+	const auto is_cancelled = [&]() {
+		if (omp_get_thread_num() == 0 && poll_input() &&
+		    (b_camera_dirty || b_window_closed)) {
+			b_cancelled.store(true, std::memory_order_relaxed);
+		}
+		if (f_pass_deadline > 0.0 && now_seconds() > f_pass_deadline) {
+			b_cancelled.store(true, std::memory_order_relaxed);
+		}
+		return b_cancelled.load(std::memory_order_relaxed);
+	};
+
+	if (v_numa_nodes.size() > 1) {
+		render_tiles_numa(i_tiles_x, i_tiles_y, i_scale, i_max_depth,
+				  is_cancelled);
+		return !b_cancelled;
+	}
 
+	// Tiles are claimed in strided order so a pass cut short by input or
+	// the deadline still covers the whole frame evenly.
+	const int32_t i_stride = tile_stride(i_num_tiles);
 #pragma omp parallel for schedule(dynamic)
-	for (int32_t i_pixel_y = 0; i_pixel_y < i_height; i_pixel_y++) {
-		for (int32_t i_pixel_x = 0; i_pixel_x < i_width; i_pixel_x++) {
+	for (int32_t k = 0; k < i_num_tiles; k++) {
+		if (is_cancelled()) {
+			continue;
+		}
+		const int32_t i_tile = strided_tile(k, i_stride, i_num_tiles);
+		render_tile(i_tile, i_tiles_x, i_scale, i_max_depth, S_scene);
+	}
+
+	return !b_cancelled;
+}
+
+void Renderer::Engine::render_tile(const int32_t i_tile,
+				   const int32_t i_tiles_x,
+				   const int32_t i_scale,
+				   const int32_t i_max_depth,
+				   const Scene &S_tile_scene)
+{
+	const int32_t i_x0 = (i_tile % i_tiles_x) * TILE_SIZE;
+	const int32_t i_y0 = (i_tile / i_tiles_x) * TILE_SIZE;
+	const int32_t i_x1 = std::min(i_x0 + TILE_SIZE, i_width);
+	const int32_t i_y1 = std::min(i_y0 + TILE_SIZE, i_height);
+	i_pass_tiles.fetch_add(1, std::memory_order_relaxed);
+
+	if (b_wavefront && i_scale == 1) {
+		thread_local std::vector<SurfaceInfo> v_surfaces;
+		wavefront::trace_tile(S_tile_scene, S_camera, i_x0, i_y0, i_x1,
+				      i_y1, i_width, i_height, u_seed,
+				      static_cast<uint32_t>(i_sample_count),
+				      i_max_depth, v_surfaces);
+		const SurfaceInfo *p_surface = v_surfaces.data();
+		for (int32_t y = i_y0; y < i_y1; y++) {
+			for (int32_t x = i_x0; x < i_x1; x++) {
+				accumulate_sample(
+					static_cast<size_t>(y) * i_width + x,
+					*p_surface++);
+			}
+		}
+		return;
+	}
+
+	for (int32_t i_block_y = i_y0; i_block_y < i_y1; i_block_y += i_scale) {
+		for (int32_t i_block_x = i_x0; i_block_x < i_x1;
+		     i_block_x += i_scale) {
+			const int32_t i_pixel_x =
+				std::min(i_block_x + i_scale / 2, i_x1 - 1);
+			const int32_t i_pixel_y =
+				std::min(i_block_y + i_scale / 2, i_y1 - 1);
 			const SurfaceInfo surface_info{
 				lighting::trace_ray_with_buffers(
-					S_scene, S_camera, p_RTCdevice,
-					i_pixel_x, i_pixel_y, i_width, i_height)
+					S_tile_scene, S_camera, p_RTCdevice,
+					i_pixel_x, i_pixel_y, i_width, i_height,
+					u_seed,
+					static_cast<uint32_t>(i_sample_count),
+					i_max_depth)
 			};
 
-			int i_index = (i_pixel_y * i_width + i_pixel_x) * 3;
-			// v_framebuffer[i_index + 0] =
-			// 	glm::clamp(vec_color.r, 0.0f, 1.0f);
-			// v_framebuffer[i_index + 1] =
-			// 	glm::clamp(vec_color.g, 0.0f, 1.0f);
-			// v_framebuffer[i_index + 2] =
-			// 	glm::clamp(vec_color.b, 0.0f, 1.0f);
-			v_framebuffer[i_index + 0] =
-				ACES_tonemapper(surface_info.color.r);
-			v_framebuffer[i_index + 1] =
-				ACES_tonemapper(surface_info.color.g);
-			v_framebuffer[i_index + 2] =
-				ACES_tonemapper(surface_info.color.b);
+			if (i_scale == 1) {
+				accumulate_sample(
+					static_cast<size_t>(i_pixel_y) *
+							i_width +
+						i_pixel_x,
+					surface_info);
+				continue;
+			}
+
+			const glm::vec3 vec_normal =
+				surface_info.normal * 0.5f + 0.5f;
+
+			// Coarse passes fill the whole block and are
+			// replaced by the first full sample.
+			const int32_t i_block_x1 =
+				std::min(i_block_x + i_scale, i_x1);
+			const int32_t i_block_y1 =
+				std::min(i_block_y + i_scale, i_y1);
+			for (int32_t y = i_block_y; y < i_block_y1; y++) {
+				for (int32_t x = i_block_x; x < i_block_x1;
+				     x++) {
+					const size_t u_pixel =
+						static_cast<size_t>(y) *
+							i_width +
+						x;
+					C_film.set_color(u_pixel,
+							 surface_info.color);
+					C_film.set_aovs(u_pixel,
+							surface_info.albedo,
+							vec_normal);
+				}
+			}
+		}
+	}
+}
+
+void Renderer::Engine::render_partial_pass(const int32_t i_num_tiles)
+{
+	const int32_t i_tiles_x = (i_width + TILE_SIZE - 1) / TILE_SIZE;
+	const int32_t i_tiles_y = (i_height + TILE_SIZE - 1) / TILE_SIZE;
+	const int32_t i_total_tiles = i_tiles_x * i_tiles_y;
+	// Scatters a short pass's extra samples over the frame instead of
+	// piling them into the top rows.
+	const int32_t i_stride = tile_stride(i_total_tiles);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int32_t k = 0; k < i_num_tiles; k++) {
+		if (now_seconds() > f_pass_deadline) {
+			continue;
+		}
+		const int32_t i_tile = strided_tile(k, i_stride, i_total_tiles);
+		render_tile(i_tile, i_tiles_x, 1, lighting::LIGHT_BOUNCE_DEPTH,
+			    S_scene);
+	}
+}
+
+Renderer::RenderReport
+Renderer::Engine::render_time_budget(const double f_budget_ms,
+				     const std::string &s_output_file)
+{
+	const double f_start = now_seconds();
+	const double f_deadline = f_start + f_budget_ms / 1000.0;
+	const double f_pixels = static_cast<double>(i_width) * i_height;
+	const double f_reserve =
+		(f_denoise_seconds_per_pixel + f_output_seconds_per_pixel) *
+		f_pixels * RESERVE_MARGIN;
+	const double f_render_deadline = f_deadline - f_reserve;
+	const int32_t i_num_tiles = ((i_width + TILE_SIZE - 1) / TILE_SIZE) *
+				    ((i_height + TILE_SIZE - 1) / TILE_SIZE);
+
+	allocate_film();
+	S_camera = S_pending_camera;
+	b_camera_dirty = false;
+	i_sample_count = 0;
+
+	RenderReport S_report;
+	while (true) {
+		const double f_pass_start = now_seconds();
+		const double f_remaining = f_render_deadline - f_pass_start;
+		// Until one pass is in, some pixels have never been written.
+		const bool b_has_frame = i_sample_count > 0;
+		if (b_has_frame && f_remaining <= 0.0) {
+			break;
+		}
+
+		int32_t i_planned = i_num_tiles;
+		if (b_has_frame && f_remaining < f_pass_seconds) {
+			i_planned = static_cast<int32_t>(
+				f_remaining / f_pass_seconds * i_num_tiles);
+			if (i_planned == 0) {
+				break;
+			}
+		}
 
-			v_albedo_buffer[i_index + 0] = surface_info.albedo.r;
-			v_albedo_buffer[i_index + 1] = surface_info.albedo.g;
-			v_albedo_buffer[i_index + 2] = surface_info.albedo.b;
+		// Pixels a cut pass reaches hold one more sample than the rest;
+		// the running mean keeps each of them exact.
+		f_pass_deadline = b_has_frame ? f_render_deadline : 0.0;
+		i_pass_tiles.store(0, std::memory_order_relaxed);
+		if (i_planned < i_num_tiles) {
+			render_partial_pass(i_planned);
+		} else {
+			render_frame(1);
+		}
+		f_pass_deadline = 0.0;
 
-			v_normal_buffer[i_index + 0] =
-				surface_info.normal.x * 0.5f + 0.5f;
-			v_normal_buffer[i_index + 1] =
-				surface_info.normal.y * 0.5f + 0.5f;
-			v_normal_buffer[i_index + 2] =
-				surface_info.normal.z * 0.5f + 0.5f;
+		const int32_t i_done =
+			i_pass_tiles.load(std::memory_order_relaxed);
+		if (i_done < i_num_tiles) {
+			S_report.f_partial_pass =
+				static_cast<double>(i_done) / i_num_tiles;
+			break;
 		}
+
+		const double f_seconds = now_seconds() - f_pass_start;
+		f_pass_seconds = f_pass_seconds > 0.0 ?
+					 blend_estimate(f_pass_seconds,
+							f_seconds) :
+					 f_seconds;
+		finish_pass();
 	}
+	const double f_render_end = now_seconds();
+
+	oidn_denoise(false);
+	const double f_denoise_end = now_seconds();
+	write_buffer_to_image(C_film.v_denoised.data(), i_width, i_height,
+			      s_output_file, true);
+	const double f_end = now_seconds();
+
+	f_denoise_seconds_per_pixel =
+		blend_estimate(f_denoise_seconds_per_pixel,
+			       (f_denoise_end - f_render_end) / f_pixels);
+	f_output_seconds_per_pixel = blend_estimate(
+		f_output_seconds_per_pixel, (f_end - f_denoise_end) / f_pixels);
+
+	S_report.i_full_passes = i_sample_count;
+	S_report.f_pass_seconds = f_pass_seconds;
+	S_report.f_render_seconds = f_render_end - f_start;
+	S_report.f_denoise_seconds = f_denoise_end - f_render_end;
+	S_report.f_output_seconds = f_end - f_denoise_end;
+	S_report.f_total_seconds = f_end - f_start;
+	S_report.b_within_budget = f_end <= f_deadline;
+	return S_report;
+}
+
+void Renderer::Engine::allocate_film()
+{
+	// Deferred so that bucket rendering never pays for a full frame.
+	if (C_film.pixel_count() != 0) {
+		return;
+	}
+	if (v_numa_nodes.empty()) {
+		C_film = Film(i_width, i_height);
+		return;
+	}
+
+	// First touch: the threads of each node zero that node's band, so
+	// its pages are allocated where they will be written.
+	C_film = Film(i_width, i_height, false);
+	const int32_t i_tiles_y = (i_height + TILE_SIZE - 1) / TILE_SIZE;
+	const int32_t i_pool_size = static_cast<int32_t>(v_thread_node.size());
+	const numa::Node S_main_cpus = bind_main_thread();
+#pragma omp parallel
+	{
+		const int32_t i_thread = omp_get_thread_num() % i_pool_size;
+		const int32_t i_node = v_thread_node[i_thread];
+		const int32_t i_node_threads = static_cast<int32_t>(
+			v_numa_nodes[i_node].v_cpus.size());
+		const int32_t i_band_y0 =
+			node_first_tile_row(i_node, i_tiles_y) * TILE_SIZE;
+		const int32_t i_band_y1 = std::min(
+			node_first_tile_row(i_node + 1, i_tiles_y) * TILE_SIZE,
+			i_height);
+		const int32_t i_rows = i_band_y1 - i_band_y0;
+		const int32_t i_rank = v_thread_rank[i_thread];
+		C_film.clear_rows(
+			i_band_y0 + i_rows * i_rank / i_node_threads,
+			i_band_y0 + i_rows * (i_rank + 1) / i_node_threads);
+	}
+	numa::bind_current_thread(S_main_cpus);
+}
+
+numa::Node Renderer::Engine::bind_main_thread()
+{
+	numa::Node S_main_cpus = numa::current_thread_cpus();
+	numa::bind_current_thread(v_numa_nodes[v_thread_node[0]]);
+	return S_main_cpus;
+}
+
+int32_t Renderer::Engine::node_first_tile_row(const int32_t i_node,
+					      const int32_t i_tiles_y) const
+{
+	return i_node * i_tiles_y / static_cast<int32_t>(v_numa_nodes.size());
+}
+
+void Renderer::Engine::render_tiles_numa(
+	const int32_t i_tiles_x, const int32_t i_tiles_y,
+	const int32_t i_scale, const int32_t i_max_depth,
+	const std::function<bool()> &is_cancelled)
+{
+	const int32_t i_num_nodes = static_cast<int32_t>(v_numa_nodes.size());
+	const int32_t i_pool_size = static_cast<int32_t>(v_thread_node.size());
+	std::vector<std::atomic<int32_t>> v_next_tile(i_num_nodes);
+	const auto tile_pixels = [&](const int32_t i_tile) {
+		const int32_t i_x0 = (i_tile % i_tiles_x) * TILE_SIZE;
+		const int32_t i_y0 = (i_tile / i_tiles_x) * TILE_SIZE;
+		const int32_t i_w = std::min(TILE_SIZE, i_width - i_x0);
+		const int32_t i_h = std::min(TILE_SIZE, i_height - i_y0);
+		return static_cast<uint64_t>(i_w * i_h);
+	};
+
+	const numa::Node S_main_cpus = bind_main_thread();
+#pragma omp parallel
+	{
+		const int32_t i_thread = omp_get_thread_num() % i_pool_size;
+		const int32_t i_node = v_thread_node[i_thread];
+		const Scene &S_local_scene =
+			v_node_scenes.empty() ? S_scene : v_node_scenes[i_node];
+		uint64_t u_samples = 0;
+
+		// Own band first, then help the other nodes finish theirs.
+		for (int32_t k = 0; k < i_num_nodes; k++) {
+			const int32_t i_band = (i_node + k) % i_num_nodes;
+			const int32_t i_first =
+				node_first_tile_row(i_band, i_tiles_y) *
+				i_tiles_x;
+			const int32_t i_last =
+				node_first_tile_row(i_band + 1, i_tiles_y) *
+				i_tiles_x;
+			const int32_t i_band_tiles = i_last - i_first;
+			// Strided within the band, as in render_frame.
+			const int32_t i_stride = tile_stride(i_band_tiles);
+			while (true) {
+				std::atomic<int32_t> &i_next =
+					v_next_tile[i_band];
+				const int32_t i_claim = i_next.fetch_add(
+					1, std::memory_order_relaxed);
+				if (i_claim >= i_band_tiles) {
+					break;
+				}
+				const int32_t i_tile =
+					i_first +
+					strided_tile(i_claim, i_stride,
+						     i_band_tiles);
+				if (is_cancelled()) {
+					continue;
+				}
+				render_tile(i_tile, i_tiles_x, i_scale,
+					    i_max_depth, S_local_scene);
+				if (i_scale == 1) {
+					u_samples += tile_pixels(i_tile);
+				}
+				if (k > 0) {
+					v_node_stolen_tiles[i_node].fetch_add(
+						1, std::memory_order_relaxed);
+				}
+			}
+		}
+		v_node_samples[i_node].fetch_add(u_samples,
+						 std::memory_order_relaxed);
+	}
+	numa::bind_current_thread(S_main_cpus);
+}
+
+void Renderer::Engine::report_node_throughput(const double f_seconds)
+{
+	for (size_t n = 0; n < v_numa_nodes.size(); n++) {
+		const uint64_t u_samples = v_node_samples[n].exchange(0);
+		const uint64_t u_stolen = v_node_stolen_tiles[n].exchange(0);
+		std::cout << "NUMA node " << v_numa_nodes[n].i_id << ": "
+			  << u_samples / f_seconds * 1e-6
+			  << " Msamples/s, " << u_stolen
+			  << " tiles taken from other nodes\n";
+	}
+}
+
+void Renderer::Engine::trace_region(const int32_t i_x0, const int32_t i_y0,
+				    const int32_t i_x1, const int32_t i_y1,
+				    const uint32_t u_sample_index,
+				    std::vector<SurfaceInfo> &v_surfaces)
+{
+	if (b_wavefront) {
+		wavefront::trace_tile(S_scene, S_camera, i_x0, i_y0, i_x1, i_y1,
+				      i_width, i_height, u_seed, u_sample_index,
+				      lighting::LIGHT_BOUNCE_DEPTH, v_surfaces);
+		return;
+	}
+
+	v_surfaces.clear();
+	for (int32_t y = i_y0; y < i_y1; y++) {
+		for (int32_t x = i_x0; x < i_x1; x++) {
+			v_surfaces.push_back(lighting::trace_ray_with_buffers(
+				S_scene, S_camera, p_RTCdevice, x, y, i_width,
+				i_height, u_seed, u_sample_index));
+		}
+	}
+}
+
+void Renderer::Engine::trace_strip_rows(Film &C_strip,
+					const int32_t i_strip_y0,
+					const int32_t i_y0, const int32_t i_y1,
+					const int sample_limit)
+{
+	const int32_t i_tiles_x = (i_width + TILE_SIZE - 1) / TILE_SIZE;
+	const int32_t i_tiles_y = (i_y1 - i_y0 + TILE_SIZE - 1) / TILE_SIZE;
+	C_strip.clear_rows(i_y0 - i_strip_y0, i_y1 - i_strip_y0);
+
+	// A stop leaves the rows with the samples they have so far, which is
+	// still a complete image to denoise.
+	for (int32_t i_sample = 0; i_sample < sample_limit && !b_stop_requested;
+	     i_sample++) {
+#pragma omp parallel for schedule(dynamic)
+		for (int32_t i_tile = 0; i_tile < i_tiles_x * i_tiles_y;
+		     i_tile++) {
+			const int32_t i_tx0 = (i_tile % i_tiles_x) * TILE_SIZE;
+			const int32_t i_ty0 =
+				i_y0 + (i_tile / i_tiles_x) * TILE_SIZE;
+			const int32_t i_tx1 =
+				std::min(i_tx0 + TILE_SIZE, i_width);
+			const int32_t i_ty1 = std::min(i_ty0 + TILE_SIZE, i_y1);
+
+			thread_local std::vector<SurfaceInfo> v_surfaces;
+			trace_region(i_tx0, i_ty0, i_tx1, i_ty1,
+				     static_cast<uint32_t>(i_sample),
+				     v_surfaces);
+
+			const SurfaceInfo *p_surface = v_surfaces.data();
+			for (int32_t y = i_ty0; y < i_ty1; y++) {
+				for (int32_t x = i_tx0; x < i_tx1; x++) {
+					const SurfaceInfo &S_surface =
+						*p_surface++;
+					const size_t u_pixel =
+						static_cast<size_t>(
+							y - i_strip_y0) *
+							i_width +
+						x;
+					C_strip.accumulate(u_pixel,
+							   S_surface.color,
+							   i_sample + 1);
+					if (i_sample == 0) {
+						C_strip.set_aovs(
+							u_pixel,
+							S_surface.albedo,
+							S_surface.normal *
+									0.5f +
+								0.5f);
+					}
+				}
+			}
+		}
+	}
+}
+
+void Renderer::Engine::denoise_bucket(Film &C_strip, const int32_t i_strip_y0,
+				      const int32_t i_strip_y1,
+				      const int32_t i_x0, const int32_t i_x1,
+				      const int32_t i_y0, const int32_t i_y1,
+				      std::vector<uint8_t> &v_band)
+{
+	// The filter reads the bucket and its overlap straight out of the
+	// strip. Neighbouring buckets overwrite each other's overlap in the
+	// output plane, but each keeps only its interior, copied out below.
+	const int32_t i_pad_x0 = std::max(i_x0 - BUCKET_OVERLAP, 0);
+	const int32_t i_pad_x1 = std::min(i_x1 + BUCKET_OVERLAP, i_width);
+	const size_t u_pad_width = i_pad_x1 - i_pad_x0;
+	const size_t u_rows = i_strip_y1 - i_strip_y0;
+	const size_t u_float3 = 3 * sizeof(float);
+	const size_t u_half3 = 3 * sizeof(uint16_t);
+
+	m_denoiser_filter.setImage("color", C_strip.v_color.data(),
+				   oidn::Format::Float3, u_pad_width, u_rows,
+				   i_pad_x0 * u_float3, u_float3,
+				   i_width * u_float3);
+	m_denoiser_filter.setImage("albedo", C_strip.v_albedo.data(),
+				   oidn::Format::Half3, u_pad_width, u_rows,
+				   i_pad_x0 * u_half3, u_half3,
+				   i_width * u_half3);
+	m_denoiser_filter.setImage("normal", C_strip.v_normal.data(),
+				   oidn::Format::Half3, u_pad_width, u_rows,
+				   i_pad_x0 * u_half3, u_half3,
+				   i_width * u_half3);
+	m_denoiser_filter.setImage("output", C_strip.v_denoised.data(),
+				   oidn::Format::Float3, u_pad_width, u_rows,
+				   i_pad_x0 * u_float3, u_float3,
+				   i_width * u_float3);
+	m_denoiser_filter.commit();
+	m_denoiser_filter.execute();
+
+	// Keep the interior only. The band is stored top row first, like the
+	// file.
+	for (int32_t y = i_y0; y < i_y1; y++) {
+		const size_t u_src_pixel =
+			static_cast<size_t>(y - i_strip_y0) * i_width + i_x0;
+		const size_t u_dst_pixel =
+			static_cast<size_t>(i_y1 - 1 - y) * i_width + i_x0;
+		const float *p_src = &C_strip.v_denoised[u_src_pixel * 3];
+		uint8_t *p_dst = &v_band[u_dst_pixel * 3];
+		for (int32_t i = 0; i < (i_x1 - i_x0) * 3; i++) {
+			p_dst[i] = static_cast<uint8_t>(
+				ACES_tonemapper(p_src[i]) * 255.0f);
+		}
+	}
+}
+
+void Renderer::Engine::render_buckets(const int sample_limit,
+				      const int32_t i_bucket_size,
+				      const std::string &s_output_file)
+{
+	std::ofstream t_output(s_output_file, std::ios::binary);
+	if (!t_output) {
+		std::cerr << "Failed to open " << s_output_file << "\n";
+		exit(EXIT_FAILURE);
+	}
+	t_output << "P6\n" << i_width << " " << i_height << "\n255\n";
+
+	// A stop ends the band in flight with the samples it has and flushes
+	// it, so the file holds every row rendered so far.
+	std::signal(SIGTERM, stop_signal_handler);
+	std::signal(SIGINT, stop_signal_handler);
+
+	// Every row is traced once, full width, into a strip spanning the
+	// band and the overlap the denoiser needs above and below it. The
+	// rows the next band shares are moved down the strip, not retraced.
+	// The radiance cache is not aged here: a pass over one strip would
+	// decay every other cell of the scene as well.
+	Film C_strip(i_width, i_bucket_size + 2 * BUCKET_OVERLAP);
+	int32_t i_strip_y0 = i_height;
+	int32_t i_strip_y1 = i_height;
+	std::vector<uint8_t> v_band(static_cast<size_t>(i_width) *
+				    i_bucket_size * 3);
+	const double f_start_time = now_seconds();
+	for (int32_t i_band_top = i_height; i_band_top > 0;
+	     i_band_top -= i_bucket_size) {
+		if (b_stop_requested) {
+			std::cerr << "Stopped, " << s_output_file
+				  << " is incomplete\n";
+			return;
+		}
+		const int32_t i_band_bottom =
+			std::max(i_band_top - i_bucket_size, 0);
+		const int32_t i_window_y0 =
+			std::max(i_band_bottom - BUCKET_OVERLAP, 0);
+		const int32_t i_window_y1 =
+			std::min(i_band_top + BUCKET_OVERLAP, i_height);
+
+		int32_t i_traced_y0 = i_window_y1;
+		if (i_strip_y1 > i_strip_y0) {
+			C_strip.move_rows(0, i_window_y1 - i_strip_y0,
+					  i_strip_y0 - i_window_y0);
+			i_traced_y0 = i_strip_y0;
+		}
+		i_strip_y0 = i_window_y0;
+		i_strip_y1 = i_window_y1;
+		trace_strip_rows(C_strip, i_strip_y0, i_window_y0, i_traced_y0,
+				 sample_limit);
+
+		for (int32_t i_x0 = 0; i_x0 < i_width; i_x0 += i_bucket_size) {
+			denoise_bucket(C_strip, i_strip_y0, i_strip_y1, i_x0,
+				       std::min(i_x0 + i_bucket_size, i_width),
+				       i_band_bottom, i_band_top, v_band);
+		}
+
+		t_output.write(reinterpret_cast<const char *>(v_band.data()),
+			       static_cast<std::streamsize>(i_width) *
+				       (i_band_top - i_band_bottom) * 3);
+		std::cout << "Buckets: " << (i_height - i_band_bottom) * 100 /
+						     i_height
+			  << "% after " << now_seconds() - f_start_time
+			  << "s\n";
+	}
+}
+
+void Renderer::Engine::accumulate_sample(const size_t u_pixel,
+					 const SurfaceInfo &S_surface)
+{
+	C_film.accumulate(u_pixel, S_surface.color, i_sample_count + 1);
+	C_film.set_aovs(u_pixel, S_surface.albedo,
+			S_surface.normal * 0.5f + 0.5f);
 }
 
-void Renderer::Engine::write_buffer_to_image(
-	const std::vector<float> &vec_buffer, const int32_t i_width,
-	const int32_t i_height, const std::string &s_output_file)
+void Renderer::Engine::write_buffer_to_image(const float *p_buffer,
+					     const int32_t i_width,
+					     const int32_t i_height,
+					     const std::string &s_output_file,
+					     const bool b_tonemap)
 {
 	stbi_set_flip_vertically_on_load(true);
 	std::vector<uint8_t> v_image(i_width * i_height * 3, 0);
@@ -399,12 +1213,13 @@ void Renderer::Engine::write_buffer_to_image(
 			int32_t i_index = (i * i_width + j) * 3;
 			int32_t i_flipped_index =
 				((i_height - i - 1) * i_width + j) * 3;
-			v_image[i_flipped_index + 0] = static_cast<uint8_t>(
-				vec_buffer[i_index + 0] * 255.0f);
-			v_image[i_flipped_index + 1] = static_cast<uint8_t>(
-				vec_buffer[i_index + 1] * 255.0f);
-			v_image[i_flipped_index + 2] = static_cast<uint8_t>(
-				vec_buffer[i_index + 2] * 255.0f);
+			for (int32_t c = 0; c < 3; c++) {
+				float f_value = p_buffer[i_index + c];
+				if (b_tonemap)
+					f_value = ACES_tonemapper(f_value);
+				v_image[i_flipped_index + c] =
+					static_cast<uint8_t>(f_value * 255.0f);
+			}
 		}
 	}
 
@@ -1,55 +1,206 @@
 #pragma once
 
+#include "checkpoint.h"
 #include "common.h"
+#include "film.h"
+#include "numa.h"
+#include "presenter.h"
+#include "radiance_cache.h"
+#include "texture_cache.h"
 
 #include <embree3/rtcore.h>
-#include <GLFW/glfw3.h>
 #include <OpenImageDenoise/oidn.hpp>
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <cstdint>
 
 namespace Renderer
 {
+// What Engine::render_time_budget did with its budget. Times are wall-clock
+// seconds.
+struct RenderReport {
+	int32_t i_full_passes = 0;
+	// Fraction of the tiles that got one more sample from a last pass that
+	// was cut short, so i_full_passes + f_partial_pass is the mean spp.
+	double f_partial_pass = 0.0;
+	// Running estimate of one full pass when rendering stopped.
+	double f_pass_seconds = 0.0;
+	double f_render_seconds = 0.0;
+	double f_denoise_seconds = 0.0;
+	double f_output_seconds = 0.0;
+	double f_total_seconds = 0.0;
+	bool b_within_budget = false;
+};
+
 class Engine {
 	int32_t i_width = 1024;
 	int32_t i_height = 1024;
 
-	GLuint m_texture_id;
-	GLFWwindow *p_window;
+	std::unique_ptr<Presenter> p_presenter;
 	RTCDevice p_RTCdevice;
 	Camera S_camera;
 	Scene S_scene;
 
 	oidn::DeviceRef m_oidn_device;
 	oidn::FilterRef m_denoiser_filter;
-	std::vector<float> v_color_buffer;
-	std::vector<float> v_albedo_buffer;
-	std::vector<float> v_normal_buffer;
-	std::vector<float> m_denoised_frame;
+	Film C_film;
+
+	Camera S_pending_camera;
+	bool b_camera_dirty = false;
+	bool b_window_closed = false;
+
+	uint64_t u_seed;
+	int32_t i_sample_count = 0;
+	std::unique_ptr<Checkpoint> p_checkpoint;
+	double f_checkpoint_interval = 60.0;
+	std::unique_ptr<RadianceCache> p_radiance_cache;
+	bool b_wavefront = false;
+	TextureCacheConfig S_texture_config;
+	std::unique_ptr<TextureCache> p_texture_cache;
+
+	// Cost model of render_time_budget, refined by every call.
+	double f_pass_seconds = 0.0;
+	double f_denoise_seconds_per_pixel;
+	double f_output_seconds_per_pixel;
+	// Passes stop handing out tiles after this time; 0 means never.
+	double f_pass_deadline = 0.0;
+	std::atomic<int32_t> i_pass_tiles{ 0 };
+
+	// Empty unless NUMA placement is enabled on a multi-node host. Node n
+	// owns a horizontal band of tiles, and with it those film rows.
+	std::vector<numa::Node> v_numa_nodes;
+	std::vector<int32_t> v_thread_node;
+	std::vector<int32_t> v_thread_rank;
+	std::vector<Scene> v_node_scenes;
+	std::vector<std::atomic<uint64_t>> v_node_samples;
+	std::vector<std::atomic<uint64_t>> v_node_stolen_tiles;
 
     private:
-	void init_glfw();
+	void init_presenter();
 	void init_embree_device();
 	void init_camera();
-	void render_frame(std::vector<float> &vec_framebuffer);
+	RTCScene build_rtc_scene(Scene &S_target);
+	void load_textures(const std::string &s_base_dir);
+	bool poll_input();
+	void restart_accumulation();
+	bool render_frame(const int32_t i_scale);
+	void finish_pass();
+	void accumulate_sample(const size_t u_pixel,
+			       const SurfaceInfo &S_surface);
+	void render_tile(const int32_t i_tile, const int32_t i_tiles_x,
+			 const int32_t i_scale, const int32_t i_max_depth,
+			 const Scene &S_tile_scene);
+	void render_partial_pass(const int32_t i_num_tiles);
+	void render_tiles_numa(const int32_t i_tiles_x, const int32_t i_tiles_y,
+			       const int32_t i_scale, const int32_t i_max_depth,
+			       const std::function<bool()> &is_cancelled);
+	int32_t node_first_tile_row(const int32_t i_node,
+				    const int32_t i_tiles_y) const;
+	// OpenMP runs thread 0 on the calling thread, so it is bound to thread
+	// 0's node for a region; returns the CPUs to restore afterwards.
+	numa::Node bind_main_thread();
+	void report_node_throughput(const double f_seconds);
+	void trace_region(const int32_t i_x0, const int32_t i_y0,
+			  const int32_t i_x1, const int32_t i_y1,
+			  const uint32_t u_sample_index,
+			  std::vector<SurfaceInfo> &v_surfaces);
+	void trace_strip_rows(Film &C_strip, const int32_t i_strip_y0,
+			      const int32_t i_y0, const int32_t i_y1,
+			      const int sample_limit);
+	void denoise_bucket(Film &C_strip, const int32_t i_strip_y0,
+			    const int32_t i_strip_y1, const int32_t i_x0,
+			    const int32_t i_x1, const int32_t i_y0,
+			    const int32_t i_y1, std::vector<uint8_t> &v_band);
+	void save_checkpoint();
+	// Color buffers hold linear radiance and want b_tonemap; albedo and
+	// normal are written as they are.
 	static void
-	write_buffer_to_image(const std::vector<float> &vec_buffer,
-			      const int32_t i_width, const int32_t i_height,
-			      const std::string &s_output_file = "output.png");
+	write_buffer_to_image(const float *p_buffer, const int32_t i_width,
+			      const int32_t i_height,
+			      const std::string &s_output_file = "output.png",
+			      const bool b_tonemap = false);
 
     public:
 	Engine(const int32_t i_width = 1024, const int32_t i_height = 1024,
-	       const float f_ambient_intensity = 0.1f);
+	       const float f_ambient_intensity = 0.1f,
+	       const bool b_headless = false);
 	~Engine();
 
+	// Limits the memory textured scenes page their tiles into. Call before
+	// load_obj_scene.
+	void configure_texture_cache(const TextureCacheConfig &S_config);
+
 	void load_obj_scene(const std::string &s_obj_file,
 			    const std::string &s_base_dir);
 
+	// Periodically snapshots the accumulation to s_path. With b_resume the
+	// render continues from the last snapshot found there.
+	void enable_checkpoints(const std::string &s_path,
+				const double f_interval_seconds,
+				const bool b_resume);
+
+	// Lets secondary bounces end in a shared radiance cache, trading a
+	// bounded amount of bias for far fewer rays per sample.
+	void enable_radiance_cache(const RadianceCacheConfig &S_config);
+
+	// Full passes trace whole tiles breadth-first through
+	// wavefront::trace_tile instead of one recursive path per pixel.
+	void use_wavefront_integrator(const bool b_enable);
+	// Replaces the random seed, so two engines draw the same samples.
+	void set_seed(const uint64_t u_new_seed);
+
+	// Pins the render threads to their NUMA nodes and splits the film into
+	// per-node bands that are first touched by their owners. With
+	// b_replicate_scene every node also gets its own copy of the scene.
+	// Call after load_obj_scene. Does nothing on single-node hosts.
+	void enable_numa(const bool b_replicate_scene);
+
+	// Restarts accumulation from a coarse preview at the next pass. Input
+	// from the window goes through the same path.
+	void set_camera(const Camera &S_new_camera);
+	const Camera &get_camera() const;
+
+	// Accumulates up to sample_limit samples, restarting whenever the
+	// camera changes. Returns early if the window closes or a stop is
+	// requested.
+	void render_samples(const int sample_limit);
+
+	// Allocates the film now rather than at the first pass.
+	void allocate_film();
+	// Adds one full pass to the film, without the input handling, logging
+	// and checkpoints of render_samples, for callers timing it themselves.
+	void render_pass();
+
 	void render_loop(const int sample_limit = 16);
 
-	void oidn_denoise();
+	// Renders, denoises and writes the image one bucket at a time into a
+	// binary PPM, without ever allocating the full-resolution film. Peak
+	// memory depends on the bucket size and the image width only.
+	// Each pixel is traced once; the denoiser's overlap comes from rows
+	// kept between bands. SIGINT or SIGTERM ends it after the current
+	// band, which keeps the samples it has, with the rows written so far.
+	void render_buckets(const int sample_limit, const int32_t i_bucket_size,
+			    const std::string &s_output_file);
+
+	// Renders a fresh frame of the current camera, denoises it and writes
+	// it to s_output_file, all within f_budget_ms where possible. Samples
+	// are scheduled from the measured cost of earlier passes, with time
+	// held back for the denoiser and the output. The first pass always
+	// completes, so a budget below one sample per pixel is overrun.
+	RenderReport render_time_budget(const double f_budget_ms,
+					const std::string &s_output_file);
+
+	void write_color_image(const std::string &s_output_file);
+
+	// Both leave their result in the film's denoised buffer.
+	void oidn_denoise(const bool b_write_image = true);
+
+	void custom_denoise(const bool b_write_image = true);
 
-	void custom_denoise();
+	int32_t get_sample_count() const;
+	const Film &get_film() const;
 };
 } // namespace Renderer
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+PCG32 generator. Every pixel sample is seeded from (seed, pixel, sample index)
+so a sample renders the same regardless of which thread traces it, which is
+what lets an interrupted render be resumed bit-for-bit.
+*/
+struct Sampler {
+	uint64_t u_state = 0x853c49e6748fea9bULL;
+	uint64_t u_inc = 0xda3e39cb94b95bdbULL;
+
+	static constexpr uint64_t splitmix64(uint64_t x)
+	{
+		x += 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	void seed(uint64_t u_seed, uint64_t u_stream)
+	{
+		u_state = 0;
+		u_inc = (u_stream << 1) | 1;
+		next_uint();
+		u_state += u_seed;
+		next_uint();
+	}
+
+	void seed_pixel(uint64_t u_seed, uint32_t u_pixel, uint32_t u_sample)
+	{
+		seed(splitmix64(u_seed ^ splitmix64(u_sample)),
+		     splitmix64(u_pixel));
+	}
+
+	uint32_t next_uint()
+	{
+		const uint64_t u_old = u_state;
+		u_state = u_old * 6364136223846793005ULL + u_inc;
+		const uint32_t u_xorshifted =
+			static_cast<uint32_t>(((u_old >> 18) ^ u_old) >> 27);
+		const uint32_t u_rot = static_cast<uint32_t>(u_old >> 59);
+		return (u_xorshifted >> u_rot) |
+		       (u_xorshifted << ((-u_rot) & 31));
+	}
+
+	// Uniform in [0, 1).
+	float next_float()
+	{
+		return static_cast<float>(next_uint() >> 8) * 0x1.0p-24f;
+	}
+};
@@ -0,0 +1,422 @@
+#include "texture_cache.h"
+#include "half.h"
+
+#include <stb_image.h>
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <iostream>
+
+static constexpr int32_t TEXTURE_TILE_SIZE = 32;
+static constexpr size_t TILE_CHANNELS =
+	TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE * 3;
+static constexpr size_t TILE_BYTES = TILE_CHANNELS * sizeof(uint16_t);
+static constexpr uint32_t NO_TILE = UINT32_MAX;
+// Keeps the four tiles of a bilinear lookup resident at any limit.
+static constexpr uint32_t MIN_SLOTS = 64;
+
+static int32_t seek_backing(std::FILE *p_file, uint64_t u_offset,
+			    int32_t i_whence)
+{
+#ifdef _WIN32
+	return _fseeki64(p_file, static_cast<int64_t>(u_offset), i_whence);
+#else
+	return fseeko(p_file, static_cast<off_t>(u_offset), i_whence);
+#endif
+}
+
+static std::array<float, 256> make_srgb_table()
+{
+	std::array<float, 256> a_table;
+	for (int32_t i = 0; i < 256; i++) {
+		const float f_c = i / 255.0f;
+		a_table[i] = f_c <= 0.04045f ?
+				     f_c / 12.92f :
+				     std::pow((f_c + 0.055f) / 1.055f, 2.4f);
+	}
+	return a_table;
+}
+
+// Decodes to linear RGB. 8-bit images are taken to be sRGB encoded.
+static bool decode_image(const std::string &s_path, int32_t &i_width,
+			 int32_t &i_height, std::vector<float> &v_rgb)
+{
+	int32_t i_channels;
+	if (stbi_is_hdr(s_path.c_str())) {
+		float *p_pixels = stbi_loadf(s_path.c_str(), &i_width,
+					     &i_height, &i_channels, 3);
+		if (!p_pixels) {
+			return false;
+		}
+		v_rgb.assign(p_pixels,
+			     p_pixels + static_cast<size_t>(i_width) *
+						i_height * 3);
+		stbi_image_free(p_pixels);
+		return true;
+	}
+
+	unsigned char *p_pixels = stbi_load(s_path.c_str(), &i_width,
+					    &i_height, &i_channels, 3);
+	if (!p_pixels) {
+		return false;
+	}
+	static const std::array<float, 256> a_srgb = make_srgb_table();
+	v_rgb.resize(static_cast<size_t>(i_width) * i_height * 3);
+	for (size_t i = 0; i < v_rgb.size(); i++) {
+		v_rgb[i] = a_srgb[p_pixels[i]];
+	}
+	stbi_image_free(p_pixels);
+	return true;
+}
+
+// Box filter to half size. Each texel averages every source texel its area
+// touches, so odd sizes keep their last row and column.
+static void downsample(const std::vector<float> &v_src, int32_t i_width,
+		       int32_t i_height, std::vector<float> &v_dst)
+{
+	const int32_t i_dst_width = std::max(i_width / 2, 1);
+	const int32_t i_dst_height = std::max(i_height / 2, 1);
+	v_dst.resize(static_cast<size_t>(i_dst_width) * i_dst_height * 3);
+	for (int32_t y = 0; y < i_dst_height; y++) {
+		const int32_t i_y0 = y * i_height / i_dst_height;
+		const int32_t i_y1 =
+			((y + 1) * i_height + i_dst_height - 1) / i_dst_height;
+		for (int32_t x = 0; x < i_dst_width; x++) {
+			const int32_t i_x0 = x * i_width / i_dst_width;
+			const int32_t i_x1 =
+				((x + 1) * i_width + i_dst_width - 1) /
+				i_dst_width;
+			glm::vec3 sum(0.0f);
+			for (int32_t i_y = i_y0; i_y < i_y1; i_y++) {
+				const float *p_row =
+					&v_src[static_cast<size_t>(i_y) *
+					       i_width * 3];
+				for (int32_t i_x = i_x0; i_x < i_x1; i_x++) {
+					const float *p_src = p_row + i_x * 3;
+					sum += glm::vec3(p_src[0], p_src[1],
+							 p_src[2]);
+				}
+			}
+			sum /= static_cast<float>((i_x1 - i_x0) *
+						  (i_y1 - i_y0));
+			float *p_dst = &v_dst[(static_cast<size_t>(y) *
+						       i_dst_width +
+					       x) * 3];
+			p_dst[0] = sum.x;
+			p_dst[1] = sum.y;
+			p_dst[2] = sum.z;
+		}
+	}
+}
+
+Renderer::TextureCache::TextureCache(const TextureCacheConfig &S_config)
+	: S_config(S_config)
+{
+	u_slot_capacity = std::max(
+		static_cast<uint32_t>(S_config.u_memory_limit_mb * 1024 *
+				      1024 / TILE_BYTES),
+		MIN_SLOTS);
+	p_slots = std::make_unique<Slot[]>(u_slot_capacity);
+	for (uint32_t i = 0; i < u_slot_capacity; i++) {
+		p_slots[i].u_tile.store(NO_TILE, std::memory_order_relaxed);
+	}
+
+	p_backing = std::tmpfile();
+	if (!p_backing) {
+		std::cerr << "Failed to create the texture backing file\n";
+		exit(EXIT_FAILURE);
+	}
+}
+
+Renderer::TextureCache::~TextureCache()
+{
+	if (p_backing) {
+		std::fclose(p_backing);
+	}
+}
+
+void Renderer::TextureCache::write_level(const std::vector<float> &v_rgb,
+					 const Level &S_level)
+{
+	const int32_t i_tiles_y =
+		(S_level.i_height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+	std::vector<float> v_tile(TILE_CHANNELS);
+	std::vector<uint16_t> v_half(TILE_CHANNELS);
+
+	seek_backing(p_backing, static_cast<uint64_t>(S_level.u_first_tile) *
+					TILE_BYTES,
+		     SEEK_SET);
+	for (int32_t i_tile_y = 0; i_tile_y < i_tiles_y; i_tile_y++) {
+		for (int32_t i_tile_x = 0; i_tile_x < S_level.i_tiles_x;
+		     i_tile_x++) {
+			// Tiles past the image edge repeat its last texel.
+			for (int32_t y = 0; y < TEXTURE_TILE_SIZE; y++) {
+				const int32_t i_y = std::min(
+					i_tile_y * TEXTURE_TILE_SIZE + y,
+					S_level.i_height - 1);
+				for (int32_t x = 0; x < TEXTURE_TILE_SIZE;
+				     x++) {
+					const int32_t i_x = std::min(
+						i_tile_x * TEXTURE_TILE_SIZE +
+							x,
+						S_level.i_width - 1);
+					const size_t u_src =
+						(static_cast<size_t>(i_y) *
+							 S_level.i_width +
+						 i_x) *
+						3;
+					const size_t u_dst =
+						(static_cast<size_t>(y) *
+							 TEXTURE_TILE_SIZE +
+						 x) *
+						3;
+					std::copy_n(&v_rgb[u_src], 3,
+						    &v_tile[u_dst]);
+				}
+			}
+			float_to_half(v_tile.data(), v_half.data(),
+				      TILE_CHANNELS);
+			if (std::fwrite(v_half.data(), TILE_BYTES, 1,
+					p_backing) != 1) {
+				std::cerr << "Failed to write the texture "
+					     "backing file\n";
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+}
+
+int32_t Renderer::TextureCache::load(const std::string &s_path)
+{
+	const auto it = m_texture_ids.find(s_path);
+	if (it != m_texture_ids.end()) {
+		return it->second;
+	}
+
+	int32_t i_width;
+	int32_t i_height;
+	std::vector<float> v_rgb;
+	if (!decode_image(s_path, i_width, i_height, v_rgb)) {
+		std::cerr << "Failed to load texture " << s_path << ": "
+			  << stbi_failure_reason() << "\n";
+		m_texture_ids[s_path] = -1;
+		return -1;
+	}
+
+	Texture S_texture;
+	S_texture.s_path = s_path;
+	S_texture.f_lod_bias =
+		0.5f * std::log2(static_cast<float>(i_width) * i_height);
+
+	// Only one level is ever held in memory while converting.
+	std::vector<float> v_next;
+	for (;;) {
+		const int32_t i_tiles_x =
+			(i_width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		const int32_t i_tiles_y =
+			(i_height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		const Level S_level{ i_width, i_height, i_tiles_x,
+				     u_num_tiles };
+		write_level(v_rgb, S_level);
+		S_texture.v_levels.push_back(S_level);
+		u_num_tiles += static_cast<uint32_t>(i_tiles_x * i_tiles_y);
+
+		if (i_width == 1 && i_height == 1) {
+			break;
+		}
+		downsample(v_rgb, i_width, i_height, v_next);
+		v_rgb.swap(v_next);
+		i_width = std::max(i_width / 2, 1);
+		i_height = std::max(i_height / 2, 1);
+	}
+	std::fflush(p_backing);
+	v_tile_slots.resize(u_num_tiles, -1);
+
+	const int32_t i_id = static_cast<int32_t>(v_textures.size());
+	v_textures.push_back(std::move(S_texture));
+	m_texture_ids[s_path] = i_id;
+	return i_id;
+}
+
+uint32_t Renderer::TextureCache::claim_slot()
+{
+	if (u_slots_used < u_slot_capacity) {
+		p_slots[u_slots_used].p_texels =
+			std::make_unique<uint16_t[]>(TILE_CHANNELS);
+		return u_slots_used++;
+	}
+
+	// CLOCK: a slot read since the last sweep gets another round.
+	for (;;) {
+		const uint32_t u_slot = u_clock_hand;
+		u_clock_hand = (u_clock_hand + 1) % u_slot_capacity;
+		if (!p_slots[u_slot].b_referenced.exchange(
+			    false, std::memory_order_relaxed)) {
+			return u_slot;
+		}
+	}
+}
+
+void Renderer::TextureCache::page_in(uint32_t u_tile)
+{
+	std::lock_guard<std::mutex> lock(m_page_mutex);
+	if (std::atomic_ref<int32_t>(v_tile_slots[u_tile])
+		    .load(std::memory_order_relaxed) >= 0) {
+		return;
+	}
+
+	std::array<uint16_t, TILE_CHANNELS> a_tile;
+	if (seek_backing(p_backing, static_cast<uint64_t>(u_tile) * TILE_BYTES,
+			 SEEK_SET) != 0 ||
+	    std::fread(a_tile.data(), TILE_BYTES, 1, p_backing) != 1) {
+		std::cerr << "Failed to read the texture backing file\n";
+		exit(EXIT_FAILURE);
+	}
+
+	const uint32_t u_slot = claim_slot();
+	Slot &S_slot = p_slots[u_slot];
+
+	// Odd while the slot is rewritten; readers that overlap retry.
+	const uint32_t u_sequence =
+		S_slot.u_sequence.load(std::memory_order_relaxed);
+	S_slot.u_sequence.store(u_sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	const uint32_t u_old_tile =
+		S_slot.u_tile.load(std::memory_order_relaxed);
+	if (u_old_tile != NO_TILE) {
+		std::atomic_ref<int32_t>(v_tile_slots[u_old_tile])
+			.store(-1, std::memory_order_relaxed);
+	}
+	for (size_t i = 0; i < TILE_CHANNELS; i++) {
+		std::atomic_ref<uint16_t>(S_slot.p_texels[i])
+			.store(a_tile[i], std::memory_order_relaxed);
+	}
+	S_slot.u_tile.store(u_tile, std::memory_order_relaxed);
+	S_slot.b_referenced.store(true, std::memory_order_relaxed);
+	S_slot.u_sequence.store(u_sequence + 2, std::memory_order_release);
+
+	std::atomic_ref<int32_t>(v_tile_slots[u_tile])
+		.store(static_cast<int32_t>(u_slot), std::memory_order_release);
+	u_tile_reads.fetch_add(1, std::memory_order_relaxed);
+}
+
+glm::vec3 Renderer::TextureCache::texel(const Level &S_level, int32_t i_x,
+					int32_t i_y)
+{
+	i_x = (i_x % S_level.i_width + S_level.i_width) % S_level.i_width;
+	i_y = (i_y % S_level.i_height + S_level.i_height) % S_level.i_height;
+	const uint32_t u_tile =
+		S_level.u_first_tile +
+		static_cast<uint32_t>((i_y / TEXTURE_TILE_SIZE) *
+					      S_level.i_tiles_x +
+				      i_x / TEXTURE_TILE_SIZE);
+	const size_t u_offset = static_cast<size_t>(
+		((i_y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE +
+		 i_x % TEXTURE_TILE_SIZE) *
+		3);
+
+	for (;;) {
+		const int32_t i_slot =
+			std::atomic_ref<int32_t>(v_tile_slots[u_tile])
+				.load(std::memory_order_acquire);
+		if (i_slot < 0) {
+			page_in(u_tile);
+			continue;
+		}
+
+		Slot &S_slot = p_slots[i_slot];
+		const uint32_t u_sequence =
+			S_slot.u_sequence.load(std::memory_order_acquire);
+		if ((u_sequence & 1) != 0 ||
+		    S_slot.u_tile.load(std::memory_order_relaxed) != u_tile) {
+			continue;
+		}
+		uint16_t a_half[3];
+		for (int32_t c = 0; c < 3; c++) {
+			a_half[c] = std::atomic_ref<uint16_t>(
+					    S_slot.p_texels[u_offset + c])
+					    .load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (S_slot.u_sequence.load(std::memory_order_relaxed) !=
+		    u_sequence) {
+			continue;
+		}
+
+		// Skip the store on hot tiles so their line stays shared.
+		if (!S_slot.b_referenced.load(std::memory_order_relaxed)) {
+			S_slot.b_referenced.store(true,
+						  std::memory_order_relaxed);
+		}
+		return load_half3(a_half);
+	}
+}
+
+glm::vec3 Renderer::TextureCache::bilinear(const Level &S_level,
+					   const glm::vec2 &vec_uv)
+{
+	// OBJ puts v = 0 at the bottom of the image.
+	const float f_x = vec_uv.x * S_level.i_width - 0.5f;
+	const float f_y = (1.0f - vec_uv.y) * S_level.i_height - 0.5f;
+	const float f_x0 = std::floor(f_x);
+	const float f_y0 = std::floor(f_y);
+	const float f_tx = f_x - f_x0;
+	const float f_ty = f_y - f_y0;
+	const int32_t i_x = static_cast<int32_t>(f_x0);
+	const int32_t i_y = static_cast<int32_t>(f_y0);
+
+	const glm::vec3 top = glm::mix(texel(S_level, i_x, i_y),
+				       texel(S_level, i_x + 1, i_y), f_tx);
+	const glm::vec3 bottom =
+		glm::mix(texel(S_level, i_x, i_y + 1),
+			 texel(S_level, i_x + 1, i_y + 1), f_tx);
+	return glm::mix(top, bottom, f_ty);
+}
+
+glm::vec3 Renderer::TextureCache::sample(int32_t i_texture,
+					 const glm::vec2 &vec_uv,
+					 float f_footprint)
+{
+	const Texture &S_texture = v_textures[i_texture];
+	// Wrapped here so large UVs do not overflow the texel math.
+	const glm::vec2 vec_wrapped = vec_uv - glm::floor(vec_uv);
+
+	const float f_max_level =
+		static_cast<float>(S_texture.v_levels.size() - 1);
+	float f_lod = 0.0f;
+	if (f_footprint > 0.0f) {
+		f_lod = std::clamp(std::log2(f_footprint) +
+					   S_texture.f_lod_bias,
+				   0.0f, f_max_level);
+	}
+	const int32_t i_level = static_cast<int32_t>(f_lod);
+	const float f_blend = f_lod - static_cast<float>(i_level);
+
+	glm::vec3 color = bilinear(S_texture.v_levels[i_level], vec_wrapped);
+	if (f_blend > 0.0f) {
+		color = glm::mix(
+			color,
+			bilinear(S_texture.v_levels[i_level + 1], vec_wrapped),
+			f_blend);
+	}
+	return color;
+}
+
+size_t Renderer::TextureCache::texture_count() const
+{
+	return v_textures.size();
+}
+
+size_t Renderer::TextureCache::backing_bytes() const
+{
+	return static_cast<size_t>(u_num_tiles) * TILE_BYTES;
+}
+
+uint64_t Renderer::TextureCache::tile_reads() const
+{
+	return u_tile_reads.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Renderer
+{
+struct TextureCacheConfig {
+	// Upper bound on resident tile memory.
+	size_t u_memory_limit_mb = 256;
+};
+
+/*
+Shared, demand-paged store for every texture of a scene. On load an image is
+decoded once, converted to linear half RGB, mip-mapped and written out tile by
+tile to an unnamed backing file; only the level layout stays in memory. Render
+threads then page tiles in as lookups touch them, up to the memory limit, after
+which a CLOCK sweep evicts tiles that have not been read since it last passed.
+
+Lookups never lock. Each resident slot carries a sequence count that eviction
+bumps around its rewrite, and a reader that sees it change retries. Misses are
+served one at a time under m_page_mutex.
+*/
+class TextureCache {
+	struct Level {
+		int32_t i_width;
+		int32_t i_height;
+		int32_t i_tiles_x;
+		uint32_t u_first_tile;
+	};
+
+	struct Texture {
+		std::string s_path;
+		std::vector<Level> v_levels;
+		// 0.5 * log2 of the texel count of level 0.
+		float f_lod_bias;
+	};
+
+	struct Slot {
+		std::atomic<uint32_t> u_sequence{ 0 };
+		std::atomic<uint32_t> u_tile;
+		std::atomic<bool> b_referenced{ false };
+		std::unique_ptr<uint16_t[]> p_texels;
+	};
+
+	TextureCacheConfig S_config;
+	std::vector<Texture> v_textures;
+	std::unordered_map<std::string, int32_t> m_texture_ids;
+
+	// Resident slot of every tile, or -1. Grows only while loading.
+	std::vector<int32_t> v_tile_slots;
+	uint32_t u_num_tiles = 0;
+
+	std::unique_ptr<Slot[]> p_slots;
+	uint32_t u_slot_capacity;
+	uint32_t u_slots_used = 0;
+	uint32_t u_clock_hand = 0;
+	std::mutex m_page_mutex;
+	std::FILE *p_backing = nullptr;
+	std::atomic<uint64_t> u_tile_reads{ 0 };
+
+    private:
+	void write_level(const std::vector<float> &v_rgb, const Level &S_level);
+	uint32_t claim_slot();
+	void page_in(uint32_t u_tile);
+	glm::vec3 texel(const Level &S_level, int32_t i_x, int32_t i_y);
+	glm::vec3 bilinear(const Level &S_level, const glm::vec2 &vec_uv);
+
+    public:
+	explicit TextureCache(const TextureCacheConfig &S_config);
+	~TextureCache();
+
+	TextureCache(const TextureCache &) = delete;
+	TextureCache &operator=(const TextureCache &) = delete;
+
+	// Converts the image at s_path into the backing file. Repeated paths
+	// share one texture. Returns -1 if the image cannot be read. Must not
+	// run concurrently with sample().
+	int32_t load(const std::string &s_path);
+
+	// Trilinear lookup with repeat wrapping. f_footprint is the width of
+	// the sampled area in UV units and picks the mip level.
+	glm::vec3 sample(int32_t i_texture, const glm::vec2 &vec_uv,
+			 float f_footprint);
+
+	size_t texture_count() const;
+	// Bytes of tiled data in the backing file, all levels included.
+	size_t backing_bytes() const;
+	uint64_t tile_reads() const;
+};
+} // namespace Renderer
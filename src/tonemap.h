@@ -0,0 +1,17 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// ACES filmic curve. The film holds linear radiance; this is only applied
+// where pixels leave the engine: 8-bit image files here, and the window in
+// the presenter's fragment shader, which repeats the curve.
+inline float ACES_tonemapper(const float x)
+{
+	static constexpr float a = 2.51f;
+	static constexpr float b = 0.03f;
+	static constexpr float c = 2.43f;
+	static constexpr float d = 0.59f;
+	static constexpr float e = 0.14f;
+	return glm::clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0f,
+			  1.0f);
+}
@@ -0,0 +1,439 @@
+#include "wavefront.h"
+#include "lighting.h"
+#include "radiance_cache.h"
+#include "sampler.h"
+
+#include <array>
+#include <cfloat>
+#include <cstring>
+
+static constexpr uint32_t DIRECTION_OCTANTS = 8;
+
+struct CacheVertex {
+	glm::vec3 vec_point;
+	glm::vec3 vec_normal;
+	glm::vec3 vec_throughput;
+	glm::vec3 vec_radiance;
+};
+
+struct PathState {
+	glm::vec3 vec_origin;
+	glm::vec3 vec_dir;
+	glm::vec3 vec_throughput;
+	glm::vec3 vec_radiance;
+	float f_bsdf_pdf;
+	int32_t i_depth;
+	lighting::RayCone S_cone;
+	Sampler S_rng;
+
+	// Every cacheable vertex that traced a bounce, as the recursive
+	// integrator stores them. Their outgoing radiance is gathered
+	// alongside the path and inserted once the path has ended.
+	int32_t i_cache_vertices;
+	std::array<CacheVertex, lighting::LIGHT_BOUNCE_DEPTH> a_cache_vertices;
+};
+
+struct HitRecord {
+	uint32_t u_path;
+	int32_t i_material;
+	float f_t;
+	glm::vec3 vec_point;
+	glm::vec3 vec_normal;
+	Material S_material;
+};
+
+struct ShadowRecord {
+	uint32_t u_path;
+	glm::vec3 vec_contribution;
+};
+
+// Kept per thread and reused across tiles so passes do not allocate.
+struct StageQueues {
+	std::vector<PathState> v_paths;
+	std::vector<uint32_t> v_active;
+	std::vector<uint32_t> v_sorted;
+	std::vector<uint32_t> v_finished;
+	std::vector<RTCRayHit> v_ray_hits;
+	std::vector<HitRecord> v_hits;
+	std::vector<HitRecord> v_hits_sorted;
+	std::vector<RTCRay> v_shadow_rays;
+	std::vector<ShadowRecord> v_shadow_records;
+	std::vector<uint32_t> v_bin_offsets;
+};
+
+static thread_local StageQueues S_queues;
+
+// Stable counting sort of v_in into v_out by a key below u_num_keys.
+template <typename T, typename KeyFn>
+static void counting_sort(const std::vector<T> &v_in, std::vector<T> &v_out,
+			  uint32_t u_num_keys, KeyFn key_of)
+{
+	std::vector<uint32_t> &v_offsets = S_queues.v_bin_offsets;
+	v_offsets.assign(u_num_keys + 1, 0);
+	for (const T &item : v_in) {
+		v_offsets[key_of(item) + 1]++;
+	}
+	for (uint32_t i = 1; i <= u_num_keys; i++) {
+		v_offsets[i] += v_offsets[i - 1];
+	}
+	v_out.resize(v_in.size());
+	for (const T &item : v_in) {
+		v_out[v_offsets[key_of(item)]++] = item;
+	}
+}
+
+static uint32_t direction_octant(const glm::vec3 &vec_dir)
+{
+	return (vec_dir.x < 0.0f ? 1u : 0u) | (vec_dir.y < 0.0f ? 2u : 0u) |
+	       (vec_dir.z < 0.0f ? 4u : 0u);
+}
+
+static void add_radiance(PathState &S_path, const glm::vec3 &vec_contribution)
+{
+	S_path.vec_radiance += vec_contribution;
+	// Seen from a cache vertex, the path's throughput up to it does not
+	// apply.
+	for (int32_t i = 0; i < S_path.i_cache_vertices; i++) {
+		CacheVertex &S_vertex = S_path.a_cache_vertices[i];
+		for (int32_t c = 0; c < 3; c++) {
+			if (S_vertex.vec_throughput[c] > 0.0f) {
+				S_vertex.vec_radiance[c] +=
+					vec_contribution[c] /
+					S_vertex.vec_throughput[c];
+			}
+		}
+	}
+}
+
+static void set_ray(RTCRay &S_ray, const glm::vec3 &vec_origin,
+		    const glm::vec3 &vec_dir, float f_tfar)
+{
+	S_ray.org_x = vec_origin.x;
+	S_ray.org_y = vec_origin.y;
+	S_ray.org_z = vec_origin.z;
+	S_ray.dir_x = vec_dir.x;
+	S_ray.dir_y = vec_dir.y;
+	S_ray.dir_z = vec_dir.z;
+	S_ray.tnear = 0.001f;
+	S_ray.tfar = f_tfar;
+	S_ray.time = 0.0f;
+	S_ray.mask = -1;
+	S_ray.id = 0;
+	S_ray.flags = 0;
+}
+
+void wavefront::trace_tile(const Scene &S_scene, const Camera &S_camera,
+			   int32_t i_x0, int32_t i_y0, int32_t i_x1,
+			   int32_t i_y1, int32_t i_width, int32_t i_height,
+			   uint64_t u_seed, uint32_t u_sample_index,
+			   int32_t i_max_depth,
+			   std::vector<SurfaceInfo> &v_surfaces)
+{
+	StageQueues &S_q = S_queues;
+	Renderer::RadianceCache *p_cache = S_scene.p_radiance_cache;
+	const uint32_t u_num_materials =
+		static_cast<uint32_t>(S_scene.v_materials.size());
+	const glm::vec3 vec_light_radiance = lighting::light_radiance();
+	const lighting::RayCone S_camera_cone =
+		lighting::camera_ray_cone(S_camera, i_height);
+	const int32_t i_tile_width = i_x1 - i_x0;
+	const size_t u_num_paths =
+		static_cast<size_t>(i_tile_width) * (i_y1 - i_y0);
+
+	v_surfaces.assign(u_num_paths, SurfaceInfo{ glm::vec3(0.0f),
+						    glm::vec3(0.0f),
+						    glm::vec3(0.0f) });
+
+	// Generate: one camera path per pixel, seeded exactly like the
+	// recursive integrator.
+	S_q.v_paths.resize(u_num_paths);
+	S_q.v_active.clear();
+	for (int32_t y = i_y0; y < i_y1; y++) {
+		for (int32_t x = i_x0; x < i_x1; x++) {
+			const uint32_t u_path = static_cast<uint32_t>(
+				(y - i_y0) * i_tile_width + (x - i_x0));
+			PathState &S_path = S_q.v_paths[u_path];
+			S_path.S_rng.seed_pixel(
+				u_seed, static_cast<uint32_t>(y * i_width + x),
+				u_sample_index);
+			S_path.vec_origin = S_camera.vec_camera_origin;
+			S_path.vec_dir = lighting::camera_ray_direction(
+				S_camera, x, y, i_width, i_height);
+			S_path.vec_throughput = glm::vec3(1.0f);
+			S_path.vec_radiance = glm::vec3(0.0f);
+			S_path.f_bsdf_pdf = 0.0f;
+			S_path.i_depth = i_max_depth;
+			S_path.S_cone = S_camera_cone;
+			S_path.i_cache_vertices = 0;
+			S_q.v_active.push_back(u_path);
+		}
+	}
+
+	RTCIntersectContext S_context;
+	rtcInitIntersectContext(&S_context);
+	S_context.flags = RTC_INTERSECT_CONTEXT_FLAG_COHERENT;
+	RTCIntersectContext S_shadow_context;
+	rtcInitIntersectContext(&S_shadow_context);
+	S_shadow_context.flags = RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+
+	while (!S_q.v_active.empty() && i_max_depth > 0) {
+		// Intersect: rays of one octant share most of their BVH
+		// traversal order.
+		counting_sort(S_q.v_active, S_q.v_sorted, DIRECTION_OCTANTS,
+			      [&](uint32_t u_path) {
+				      return direction_octant(
+					      S_q.v_paths[u_path].vec_dir);
+			      });
+		const uint32_t u_num_rays =
+			static_cast<uint32_t>(S_q.v_sorted.size());
+		S_q.v_ray_hits.resize(u_num_rays);
+		for (uint32_t i = 0; i < u_num_rays; i++) {
+			const PathState &S_path = S_q.v_paths[S_q.v_sorted[i]];
+			RTCRayHit &S_ray_hit = S_q.v_ray_hits[i];
+			set_ray(S_ray_hit.ray, S_path.vec_origin,
+				S_path.vec_dir, FLT_MAX);
+			S_ray_hit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+			S_ray_hit.hit.primID = RTC_INVALID_GEOMETRY_ID;
+		}
+		rtcIntersect1M(S_scene.p_RTCscene, &S_context,
+			       S_q.v_ray_hits.data(), u_num_rays,
+			       sizeof(RTCRayHit));
+		// Only camera rays are coherent.
+		S_context.flags = RTC_INTERSECT_CONTEXT_FLAG_INCOHERENT;
+
+		S_q.v_hits.clear();
+		S_q.v_finished.clear();
+		for (uint32_t i = 0; i < u_num_rays; i++) {
+			const uint32_t u_path = S_q.v_sorted[i];
+			PathState &S_path = S_q.v_paths[u_path];
+			const RTCRayHit &S_ray_hit = S_q.v_ray_hits[i];
+			const bool b_camera_ray = S_path.f_bsdf_pdf == 0.0f;
+			const bool b_hit =
+				S_ray_hit.hit.geomID != RTC_INVALID_GEOMETRY_ID;
+
+			HitRecord S_hit;
+			if (b_hit) {
+				RTCGeometry p_geom =
+					rtcGetGeometry(S_scene.p_RTCscene,
+						       S_ray_hit.hit.geomID);
+				GeometryUserData *p_user_data =
+					(GeometryUserData *)
+						rtcGetGeometryUserData(p_geom);
+				S_hit.u_path = u_path;
+				S_hit.i_material = lighting::material_index(
+					p_user_data->mesh_ptr,
+					S_ray_hit.hit.primID, u_num_materials);
+				S_hit.f_t = S_ray_hit.ray.tfar;
+				S_hit.S_material =
+					lighting::fetch_textured_material(
+						S_scene, p_user_data->mesh_ptr,
+						S_ray_hit.hit, S_path.vec_dir,
+						S_path.S_cone.f_width +
+							S_path.S_cone.f_spread *
+								S_hit.f_t);
+				S_hit.vec_normal = glm::normalize(glm::vec3(
+					S_ray_hit.hit.Ng_x, S_ray_hit.hit.Ng_y,
+					S_ray_hit.hit.Ng_z));
+				if (b_camera_ray) {
+					v_surfaces[u_path].albedo =
+						S_hit.S_material.diffuse;
+					v_surfaces[u_path].normal =
+						S_hit.vec_normal;
+				}
+			}
+
+			const float f_light_t = lighting::intersect_light(
+				S_path.vec_origin, S_path.vec_dir);
+			if (f_light_t < S_ray_hit.ray.tfar) {
+				const float f_light_pdf = lighting::light_pdf(
+					f_light_t, S_path.vec_dir);
+				float f_weight = 1.0f;
+				if (!b_camera_ray) {
+					f_weight = lighting::power_heuristic(
+						1, S_path.f_bsdf_pdf,
+						lighting::SHADOW_SAMPLES,
+						f_light_pdf);
+				}
+				add_radiance(S_path,
+					     S_path.vec_throughput *
+						     vec_light_radiance *
+						     f_weight);
+				S_q.v_finished.push_back(u_path);
+				continue;
+			}
+			if (!b_hit) {
+				S_q.v_finished.push_back(u_path);
+				continue;
+			}
+
+			S_hit.vec_point = S_path.vec_origin +
+					  S_path.vec_dir * S_ray_hit.ray.tfar;
+			if (glm::dot(S_hit.vec_normal, S_path.vec_dir) > 0.0f) {
+				S_hit.vec_normal = -S_hit.vec_normal;
+			}
+			S_q.v_hits.push_back(S_hit);
+		}
+
+		// Shade: hits of one material run the same BSDF code with the
+		// same parameters back to back.
+		counting_sort(S_q.v_hits, S_q.v_hits_sorted,
+			      u_num_materials + 1, [](const HitRecord &S_hit) {
+				      return static_cast<uint32_t>(
+					      S_hit.i_material + 1);
+			      });
+		S_q.v_active.clear();
+		S_q.v_shadow_rays.clear();
+		S_q.v_shadow_records.clear();
+		for (const HitRecord &S_hit : S_q.v_hits_sorted) {
+			PathState &S_path = S_q.v_paths[S_hit.u_path];
+			const Material &S_material = S_hit.S_material;
+			const glm::vec3 &vec_normal = S_hit.vec_normal;
+			const glm::vec3 vec_view_dir = -S_path.vec_dir;
+
+			const bool b_cacheable =
+				p_cache && S_path.f_bsdf_pdf > 0.0f &&
+				lighting::specular_probability(S_material) <
+					lighting::MAX_CACHED_SPECULAR;
+			glm::vec3 vec_cached;
+			if (b_cacheable && p_cache->lookup(S_hit.vec_point,
+							   vec_normal,
+							   vec_cached)) {
+				add_radiance(S_path, S_path.vec_throughput *
+							     vec_cached);
+				S_q.v_finished.push_back(S_hit.u_path);
+				continue;
+			}
+
+			const bool b_continue = S_path.i_depth > 1;
+			if (b_cacheable && b_continue &&
+			    S_path.i_cache_vertices <
+				    lighting::LIGHT_BOUNCE_DEPTH) {
+				S_path.a_cache_vertices
+					[S_path.i_cache_vertices++] = {
+					S_hit.vec_point, vec_normal,
+					S_path.vec_throughput, glm::vec3(0.0f)
+				};
+			}
+
+			const glm::vec3 vec_emitted =
+				S_material.emission +
+				S_material.diffuse *
+					S_scene.f_ambient_intensity;
+			add_radiance(S_path,
+				     S_path.vec_throughput * vec_emitted);
+
+			// Queue the light samples; their contribution only
+			// counts if the shadow stage finds them unoccluded.
+			const glm::vec3 vec_origin =
+				S_hit.vec_point + 0.001f * vec_normal;
+			for (int32_t i = 0; i < lighting::SHADOW_SAMPLES; i++) {
+				lighting::LightSample S_light;
+				if (!lighting::sample_light(vec_origin, i,
+							    S_path.S_rng,
+							    S_light)) {
+					continue;
+				}
+				const float f_n_dot_l =
+					glm::dot(vec_normal, S_light.vec_dir);
+				if (f_n_dot_l <= 0.0f) {
+					continue;
+				}
+				const float f_bsdf_pdf = lighting::bsdf_pdf(
+					S_material, vec_normal, vec_view_dir,
+					S_light.vec_dir);
+				float f_weight = 1.0f;
+				if (b_continue) {
+					f_weight = lighting::power_heuristic(
+						lighting::SHADOW_SAMPLES,
+						S_light.f_pdf, 1, f_bsdf_pdf);
+				}
+				const glm::vec3 vec_contribution =
+					S_path.vec_throughput *
+					lighting::evaluate_bsdf(
+						S_material, vec_normal,
+						vec_view_dir, S_light.vec_dir) *
+					vec_light_radiance *
+					(f_n_dot_l * f_weight /
+					 (S_light.f_pdf *
+					  lighting::SHADOW_SAMPLES));
+
+				RTCRay S_shadow_ray;
+				set_ray(S_shadow_ray, vec_origin,
+					S_light.vec_dir,
+					S_light.f_dist - 0.001f);
+				S_q.v_shadow_rays.push_back(S_shadow_ray);
+				S_q.v_shadow_records.push_back(
+					{ S_hit.u_path, vec_contribution });
+			}
+
+			if (!b_continue) {
+				S_q.v_finished.push_back(S_hit.u_path);
+				continue;
+			}
+
+			const glm::vec3 vec_new_dir =
+				lighting::sample_bsdf_direction(
+					S_material, vec_normal, vec_view_dir,
+					S_path.S_rng);
+			const float f_cos_theta =
+				glm::dot(vec_normal, vec_new_dir);
+			const float f_pdf = lighting::bsdf_pdf(
+				S_material, vec_normal, vec_view_dir,
+				vec_new_dir);
+			if (f_cos_theta <= 0.0f || f_pdf <= 0.0f) {
+				S_q.v_finished.push_back(S_hit.u_path);
+				continue;
+			}
+
+			S_path.vec_throughput *=
+				lighting::evaluate_bsdf(S_material, vec_normal,
+							vec_view_dir,
+							vec_new_dir) *
+				(f_cos_theta / f_pdf);
+			S_path.vec_origin = vec_origin;
+			S_path.vec_dir = vec_new_dir;
+			S_path.f_bsdf_pdf = f_pdf;
+			S_path.i_depth--;
+			S_path.S_cone = lighting::bounce_ray_cone(
+				S_path.S_cone, S_hit.f_t, S_material);
+			S_q.v_active.push_back(S_hit.u_path);
+		}
+
+		// Shadow: occlusion only, no hit data needed.
+		const uint32_t u_num_shadow_rays =
+			static_cast<uint32_t>(S_q.v_shadow_rays.size());
+		if (u_num_shadow_rays > 0) {
+			rtcOccluded1M(S_scene.p_RTCscene, &S_shadow_context,
+				      S_q.v_shadow_rays.data(),
+				      u_num_shadow_rays, sizeof(RTCRay));
+		}
+		for (uint32_t i = 0; i < u_num_shadow_rays; i++) {
+			if (S_q.v_shadow_rays[i].tfar >= 0.0f) {
+				const ShadowRecord &S_record =
+					S_q.v_shadow_records[i];
+				add_radiance(S_q.v_paths[S_record.u_path],
+					     S_record.vec_contribution);
+			}
+		}
+
+		// Paths that ended this round have received all their light.
+		if (p_cache) {
+			for (const uint32_t u_path : S_q.v_finished) {
+				const PathState &S_path = S_q.v_paths[u_path];
+				for (int32_t i = 0; i < S_path.i_cache_vertices;
+				     i++) {
+					const CacheVertex &S_vertex =
+						S_path.a_cache_vertices[i];
+					p_cache->insert(S_vertex.vec_point,
+							S_vertex.vec_normal,
+							S_vertex.vec_radiance);
+				}
+			}
+		}
+	}
+
+	// Accumulate.
+	for (size_t u_path = 0; u_path < u_num_paths; u_path++) {
+		v_surfaces[u_path].color = S_q.v_paths[u_path].vec_radiance;
+	}
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+
+#include <embree3/rtcore.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace wavefront
+{
+/*
+Breadth-first alternative to lighting::trace_ray_with_buffers. Every pixel of
+the tile [i_x0, i_x1) x [i_y0, i_y1) starts a path and each bounce runs as a
+sequence of stages over all live paths: intersect, shade, shadow. Rays are
+binned by direction octant before traversal and hits by material before
+shading, and both traversals go through Embree's stream API.
+
+Runs the recursive integrator's estimator, one sample per pixel, written
+row-major into v_surfaces. Paths draw the same random numbers as the recursive
+integrator for the same seed, so without the radiance cache both give the same
+film up to float rounding; `convergence --compare-integrators SPP` checks it.
+With the cache on, lookups may see cells filled in a different order.
+*/
+void trace_tile(const Scene &S_scene, const Camera &S_camera, int32_t i_x0,
+		int32_t i_y0, int32_t i_x1, int32_t i_y1, int32_t i_width,
+		int32_t i_height, uint64_t u_seed, uint32_t u_sample_index,
+		int32_t i_max_depth, std::vector<SurfaceInfo> &v_surfaces);
+
+} // namespace wavefront